@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Prerequisites.h"
+#include "Image.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+/*
+ * AsyncEncoder class
+ * Encodes images to BMP (or QOI, by extension) files on a background writer thread.
+ * encode() copies the pixels into a pooled buffer and returns right away, so the caller can
+ * render the next frame while the previous one is written. When maxQueued images are already
+ * waiting, encode() blocks until the writer catches up.
+*/
+class AsyncEncoder
+{
+ public:
+  /*
+   * @param maxQueued: number of images that can wait to be written before encode() blocks
+   * @param syncEvery: flush written files to the disk (fdatasync) in batches of syncEvery files, 0 to never sync.
+   *                   A batch is also synced when the queue runs dry, and each future resolves once its file is synced.
+  */
+  explicit AsyncEncoder(uint32 maxQueued = 2, uint32 syncEvery = 0);
+  ~AsyncEncoder();
+
+  AsyncEncoder(const AsyncEncoder&) = delete;
+  AsyncEncoder& operator=(const AsyncEncoder&) = delete;
+
+  /*
+   * Queue a view to be encoded to a BMP file
+   * @param image: view to encode, copied before returning
+   * @param filename: name of the BMP file, or of the QOI file when it ends in .qoi
+   * @param topDown: write rows top-down (negative height)
+   * @return: future that becomes true when the file was written (and synced, if syncEvery > 0), false on errors
+  */
+  std::future<bool>
+  encode(const ConstImageView& image, const std::string& filename, bool topDown = false);
+
+  /*
+   * Queue an image to be encoded to a BMP file
+   * @param image: image to encode, copied before returning
+   * @param filename: name of the BMP file, or of the QOI file when it ends in .qoi
+   * @param topDown: write rows top-down (negative height)
+   * @return: future that becomes true when the file was written (and synced, if syncEvery > 0), false on errors
+  */
+  std::future<bool>
+  encode(const BitmapImage& image, const std::string& filename, bool topDown = false);
+
+  /*
+   * Wait until every queued image has been written and synced
+  */
+  void
+  flush();
+
+ private:
+  /*
+   * Job struct
+   * Snapshot of an image waiting to be written
+  */
+  struct Job
+  {
+    std::string filename;
+    uint32 width;
+    uint32 height;
+    BPP bpp;
+    bool topDown;
+    Vector<uint8> pixels;
+    std::promise<bool> result;
+  };
+
+  /*
+   * PendingSync struct
+   * Written file waiting for the next sync, its future resolves after the sync
+  */
+  struct PendingSync
+  {
+    std::string path;
+    std::promise<bool> result;
+  };
+
+  /*
+   * Writer thread loop
+  */
+  void
+  writerLoop();
+
+  /*
+   * Flush the data of the files written since the last sync to the disk and resolve their futures
+  */
+  void
+  syncPending();
+
+  uint32 m_maxQueued;
+  uint32 m_syncEvery;
+  bool m_stop;
+  bool m_writing;
+  uint32 m_reserved; //slots taken by encode() calls still copying their pixels
+  std::deque<Job> m_queue;
+  Vector<Vector<uint8>> m_bufferPool;
+  Vector<PendingSync> m_pendingSync; //only touched by the writer thread
+  std::mutex m_mutex;
+  std::condition_variable m_queueChanged;
+  std::thread m_writer;
+};
@@ -26,6 +26,20 @@ public:
   static Color 
   from16Bit(uint16_t value, bool isRGB565 = true);
 
+  /*
+   * Get the lookup table that converts sRGB encoded channels to linear light
+   * @return: 256 linear values in [0, kLinearMax], indexed by sRGB value
+   */
+  static const uint16*
+  getLinearTable();
+
+  /*
+   * Get the lookup table that converts linear light channels back to sRGB
+   * @return: kLinearMax + 1 sRGB values, indexed by linear value
+   */
+  static const uint8*
+  getSRGBTable();
+
   /*
    * Compare two colors
    * @param color: color to compare with
@@ -44,6 +58,9 @@ public:
   static const Color Blue;
   static const Color Transparent;
 
+  // Linear light channels are 12-bit, every sRGB value survives a round trip through the tables
+  static constexpr uint32 kLinearMax = 4095;
+
   uint8 r;
   uint8 g;
   uint8 b;
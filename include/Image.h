@@ -4,6 +4,8 @@
 #include "Color.h"
 #include "Rect.h"
 
+#include <functional>
+
 //Ref: http://www.ece.ualberta.ca/~elliott/ee552/studentAppNotes/2003_w/misc/bmp_file_format/bmp_file_format.htm
 
 #pragma pack(push, 1)
@@ -48,6 +50,48 @@ struct BMPInfoHeader
   int32 importantColors;
 };
 
+/*
+ * BMPV4Header struct
+ * Represents the BITMAPV4HEADER information header, adds channel masks and color space
+*/
+struct BMPV4Header
+{
+  BMPInfoHeader info;
+  uint32 redMask;
+  uint32 greenMask;
+  uint32 blueMask;
+  uint32 alphaMask;
+  int32 colorSpaceType;
+  int32 endpoints[9];
+  int32 gammaRed;
+  int32 gammaGreen;
+  int32 gammaBlue;
+};
+
+/*
+ * BMPV5Header struct
+ * Represents the BITMAPV5HEADER information header, adds rendering intent and ICC profile
+*/
+struct BMPV5Header
+{
+  BMPV4Header v4;
+  int32 intent;
+  int32 profileData;
+  int32 profileSize;
+  int32 reserved;
+};
+
+/*
+ * BMPCompression enum class
+ * Represents the compression field of a BMP information header
+*/
+enum class BMPCompression: int32
+{
+  RGB = 0,
+  BITFIELDS = 3,
+  ALPHABITFIELDS = 6
+};
+
 /*
  * BPP enum class
  * Represents the bits per pixel of a BMP file
@@ -77,6 +121,308 @@ enum class TextureMode
   STRETCH
 };
 
+/*
+ * DitherMode enum class
+ * Represents how colors are quantized when converting to 16 bits per pixel
+*/
+enum class DitherMode
+{
+  NONE,           //nearest 16-bit color
+  ORDERED,        //8x8 Bayer matrix
+  FLOYD_STEINBERG //error diffusion
+};
+
+/*
+ * ResizeFilter enum class
+ * Represents how pixels are sampled when resizing
+*/
+enum class ResizeFilter
+{
+  NEAREST, //nearest pixel, the corner pixels map onto each other
+  AREA     //average of the source pixels covered by each destination pixel, nearest when enlarging
+};
+
+/*
+ * BlendSpace enum class
+ * Represents the color space filters average pixels in
+*/
+enum class BlendSpace
+{
+  SRGB,  //average the stored bytes, fast but darkens fine detail when downscaling
+  LINEAR //average in linear light, converting through the Color lookup tables
+};
+
+/*
+ * ImageDiff struct
+ * Result of a pixel by pixel comparison of two images
+*/
+struct ImageDiff
+{
+  uint64 count = 0;  //number of differing pixels
+  uint32 firstX = 0; //first differing pixel in row-major order, only valid when count > 0
+  uint32 firstY = 0;
+  Rect bounds;       //bounding box of the differing pixels, empty when count is 0
+};
+
+
+class ImageView;
+
+/*
+ * ConstImageView class
+ * Non-owning, read-only view over the pixels of an image (or a region of one).
+ * Rows are stride bytes apart, so a view can describe a sub-rectangle of a
+ * larger image without copying. The viewed pixels must outlive the view.
+*/
+class ConstImageView
+{
+ public:
+  ConstImageView() : m_pixels(nullptr), m_width(0), m_height(0), m_stride(0), m_bpp(BPP::BPP_24), m_bytesPerPixel(3) {};
+  ConstImageView(const uint8* pixels, uint32 width, uint32 height, uint32 stride, BPP bpp);
+
+  /*
+   * Getters
+  */
+  inline uint32
+  getWidth() const { return m_width; }
+
+  inline uint32
+  getHeight() const { return m_height; }
+
+  inline uint32
+  getStride() const { return m_stride; }
+
+  inline BPP
+  getBPP() const { return m_bpp; }
+
+  inline uint8
+  getBytesPerPixel() const { return m_bytesPerPixel; }
+
+  inline bool
+  isEmpty() const { return m_pixels == nullptr || m_width == 0 || m_height == 0; }
+
+  inline const uint8*
+  getRow(uint32 y) const { return m_pixels + static_cast<size_t>(y) * m_stride; }
+
+  /*
+   * Get a view of a region of this view
+   * @param rect: region of the view, clamped to the view bounds
+   * @return: view of the region, empty if the region is outside of the view
+  */
+  ConstImageView
+  getSubView(const Rect& rect) const;
+
+  /*
+   * Get the color of a pixel
+   * @param x: x-coordinate of the pixel
+   * @param y: y-coordinate of the pixel
+   * @return: color of the pixel
+  */
+  Color
+  getPixel(uint32 x, uint32 y) const;
+
+  /*
+   * Resize this view into another view, the result has the size of the destination
+   * @param dst: destination view
+   * @param filter: resize filter
+   * @param space: color space of the AREA filter averages, ignored by NEAREST
+  */
+  void
+  resizeInto(ImageView dst,
+             ResizeFilter filter = ResizeFilter::NEAREST,
+             BlendSpace space = BlendSpace::SRGB) const;
+
+  /*
+   * Convert this view to 16 bits per pixel
+   * @param dst: BPP_16 destination view, only the area shared by both views is converted
+   * @param mode: dither mode
+   * @param isRGB565: true to write RGB565 pixels, false to write RGB555 pixels (e.g. for display buffers)
+  */
+  void
+  convertTo16Bit(ImageView dst, DitherMode mode = DitherMode::NONE, bool isRGB565 = true) const;
+
+  /*
+   * Compare the pixels of this view with another view, padding between rows is ignored.
+   * Equal runs of pixels are skipped with wide compares.
+   * @param other: view to compare with, must have the same size and BPP
+   * @param diff: receives the number, first position and bounding box of the differing pixels
+   * @param stopAtFirst: stop at the first differing pixel, diff then holds a count of 1 and a 1x1 bounding box
+   * @return: true if the views could be compared, false if their size or BPP differ
+  */
+  bool
+  compare(const ConstImageView& other, ImageDiff& diff, bool stopAtFirst = false) const;
+
+  /*
+   * Get a 64-bit hash of the size, BPP and pixels of the view (XXH64), padding between rows is ignored.
+   * Views with the same pixels get the same hash whatever their stride, so it can be used as a cache key.
+   * @return: content hash
+  */
+  uint64
+  getContentHash() const;
+
+  /*
+   * Get a 64-bit perceptual hash of the view (dHash): the luma of the view is box filtered down to 9x8 and
+   * each bit tells whether a cell is brighter than its right neighbor. Resized or slightly edited copies of
+   * an image get hashes a few bits apart, see perceptualDistance().
+   * @return: perceptual hash
+  */
+  uint64
+  getPerceptualHash() const;
+
+  /*
+   * Encode the view to a BMP file, or to a QOI file when the name has a .qoi extension
+   * @param filename: name of the BMP file (".bmp" is appended) or of the QOI file
+   * @param topDown: write rows top-down (negative height), the pixels are written in one contiguous write
+   *                 when rows need no padding and are contiguous in memory
+  */
+  void
+  encode(const std::string& filename, bool topDown = false) const;
+
+ protected:
+  const uint8* m_pixels;
+  uint32 m_width;
+  uint32 m_height;
+  uint32 m_stride; //bytes between rows
+  BPP m_bpp;
+  uint8 m_bytesPerPixel;
+};
+
+/*
+ * ImageView class
+ * Non-owning, writable view over the pixels of an image (or a region of one).
+ * Adds the operations that modify pixels to ConstImageView, and can be passed
+ * wherever a read-only view is expected.
+*/
+class ImageView : public ConstImageView
+{
+ public:
+  ImageView() {};
+  ImageView(uint8* pixels, uint32 width, uint32 height, uint32 stride, BPP bpp)
+    : ConstImageView(pixels, width, height, stride, bpp) {};
+
+  // Writable views are only created from writable pixels
+  inline uint8*
+  getRow(uint32 y) const { return const_cast<uint8*>(ConstImageView::getRow(y)); }
+
+  /*
+   * Get a view of a region of this view
+   * @param rect: region of the view, clamped to the view bounds
+   * @return: view of the region, empty if the region is outside of the view
+  */
+  ImageView
+  getSubView(const Rect& rect) const;
+
+  /*
+   * Set the color of a pixel
+   * @param x: x-coordinate of the pixel
+   * @param y: y-coordinate of the pixel
+   * @param color: color to set the pixel with
+  */
+  void
+  setPixel(uint32 x, uint32 y, const Color& color);
+
+  /*
+   * Clear the view with a color
+   * @param color: color to clear the view with
+  */
+  void
+  clear(const Color& color);
+
+  /*
+   * Clear a region of the view with a color
+   * @param rect: region to clear, clamped to the view bounds
+   * @param color: color to clear the region with
+  */
+  void
+  clear(const Rect& rect, const Color& color);
+
+  /*
+   * Fill a rectangle of the view with a color.
+   * Uses wide stores, non-temporal stores for large fills and splits large fills across threads.
+   * @param rect: rectangle to fill, clamped to the view bounds
+   * @param color: color to fill the rectangle with
+  */
+  void
+  fillRect(const Rect& rect, const Color& color);
+
+  /*
+   * Copy a portion of the source view to this view.
+   * Same as BitmapImage::bitBlt but the coordinate tables are not cached.
+   * @param src: source view
+   * @param srcRect: source rectangle
+   * @param dstRect: destination rectangle
+   * @param mode: texture mode (NONE, REPEAT, CLAMP, MIRROR, STRETCH)
+   * @param colorKey: color key for transparency
+  */
+  void
+  bitBlt(const ConstImageView& src,
+         const Rect& srcRect,
+         const Rect& dstRect,
+         const TextureMode mode = TextureMode::NONE,
+         const Color& colorKey = Color::Black);
+
+  /*
+   * Copy pixels of src into this view through per-column and per-row source coordinate tables
+   * @param src: source view
+   * @param srcXTable: source column for each column of this view, negative entries are skipped
+   * @param srcYTable: source row for each row of this view, negative entries are skipped
+   * @param colorKey: color key for transparency
+  */
+  void
+  gather(const ConstImageView& src, const int32* srcXTable, const int32* srcYTable, const Color& colorKey);
+};
+
+/*
+ * Write a BMP file from rows provided by a callback
+ * @param filename: name of the BMP file, without extension
+ * @param width: width of the image
+ * @param height: height of the image
+ * @param bpp: bits per pixel, 16bpp rows are RGB565
+ * @param topDown: write rows top-down (negative height)
+ * @param getRow: returns the pixels of row y, rows are requested in file order
+ * @param contiguousPixels: all rows back to back if available, lets a top-down file be written in one write
+ * @return: true if successful, false otherwise
+*/
+bool
+encodeBMP(const std::string& filename,
+          uint32 width,
+          uint32 height,
+          BPP bpp,
+          bool topDown,
+          const std::function<const uint8*(uint32 y)>& getRow,
+          const uint8* contiguousPixels = nullptr);
+
+/*
+ * Get the number of bits that differ between two perceptual hashes
+ * @param a: first hash
+ * @param b: second hash
+ * @return: distance in [0, 64], near duplicates are usually within 10
+*/
+uint32
+perceptualDistance(uint64 a, uint64 b);
+
+/*
+ * Check if a path names a QOI file (.qoi extension, any case)
+ * @param path: file path
+ * @return: true for QOI files, false otherwise
+*/
+bool
+isQOIFile(const std::string& path);
+
+/*
+ * Write a QOI file from rows provided by a callback, rows are always stored top-down
+ * @param filename: name of the QOI file, including the extension
+ * @param width: width of the image
+ * @param height: height of the image
+ * @param bpp: bits per pixel (BPP_24 or BPP_32)
+ * @param getRow: returns the pixels of row y, rows are requested top to bottom
+ * @return: true if successful, false otherwise
+*/
+bool
+encodeQOI(const std::string& filename,
+          uint32 width,
+          uint32 height,
+          BPP bpp,
+          const std::function<const uint8*(uint32 y)>& getRow);
 
 /* 
  * BitmapImage class
@@ -100,6 +446,28 @@ class BitmapImage
   inline BPP
   getBPP() const { return m_bpp; }
 
+  /*
+   * Get a view of the whole image
+   * @return: view of the image
+  */
+  ImageView
+  getView();
+
+  /*
+   * Get a read-only view of the whole image
+   * @return: view of the image
+  */
+  ConstImageView
+  getView() const;
+
+  /*
+   * Get a view of a region of the image without copying it
+   * @param rect: region of the image, clamped to the image bounds
+   * @return: view of the region
+  */
+  ImageView
+  getView(const Rect& rect);
+
   /*
    * Create a new bitmap image
    * @param width: width of the image
@@ -116,6 +484,23 @@ class BitmapImage
   void
   clear(const Color& color);
 
+  /*
+   * Clear a region of the image with a color
+   * @param rect: region to clear, clamped to the image bounds
+   * @param color: color to clear the region with
+  */
+  void
+  clear(const Rect& rect, const Color& color);
+
+  /*
+   * Fill a rectangle of the image with a color.
+   * Uses wide stores, non-temporal stores for large fills and splits large fills across threads.
+   * @param rect: rectangle to fill, clamped to the image bounds
+   * @param color: color to fill the rectangle with
+  */
+  void
+  fillRect(const Rect& rect, const Color& color);
+
   /*
    * Get the color of a pixel
    * @param x: x-coordinate of the pixel
@@ -153,19 +538,51 @@ class BitmapImage
   setColor(float u, float v, const Color& color);
 
   /*
-   * Decode a BMP file
-   * @param bmpPath: path to the BMP file
+   * Decode a BMP file, or a QOI file when the path has a .qoi extension
+   * @param bmpPath: path to the BMP or QOI file
    * @return: true if successful, false otherwise
   */
   bool
   decode(const std::string& bmpPath);
 
   /*
-   * Encode the image to a BMP file
-   * @param filename: name of the BMP file
+   * Decode a region of a BMP file, or of a QOI file when the path has a .qoi extension, optionally downscaled.
+   * Only the rows and columns of a BMP file needed by the result are read. QOI files are decoded
+   * sequentially up to the last row of the region, keeping only the needed rows and columns.
+   * @param bmpPath: path to the BMP or QOI file
+   * @param region: region of the file to decode, clamped to the file dimensions
+   * @param downscale: integer downscale factor, the result is ceil(region / downscale) pixels
+   * @param boxFilter: average each downscale x downscale block instead of sampling
+   *                   its top-left pixel (reads every row of the region)
+   * @param space: color space of the box filter averages
+   * @return: true if successful, false otherwise
+  */
+  bool
+  decode(const std::string& bmpPath,
+         const Rect& region,
+         uint32 downscale = 1,
+         bool boxFilter = false,
+         BlendSpace space = BlendSpace::SRGB);
+
+  /*
+   * Decode a downscaled (thumbnail) version of a BMP file, or of a QOI file when the path has a .qoi extension
+   * @param bmpPath: path to the BMP or QOI file
+   * @param downscale: integer downscale factor
+   * @param boxFilter: average each downscale x downscale block instead of sampling it
+   * @param space: color space of the box filter averages
+   * @return: true if successful, false otherwise
+  */
+  bool
+  decode(const std::string& bmpPath, uint32 downscale, bool boxFilter = false, BlendSpace space = BlendSpace::SRGB);
+
+  /*
+   * Encode the image to a BMP file, or to a QOI file when the name has a .qoi extension
+   * @param filename: name of the BMP file (".bmp" is appended) or of the QOI file
+   * @param topDown: write rows top-down (negative height), the pixels are written in one contiguous write
+   *                 when rows need no padding
   */
   void
-  encode(const std::string& filename) const;
+  encode(const std::string& filename, bool topDown = false) const;
 
   /*
    * Copy a portion of the source image to the destination image
@@ -182,84 +599,164 @@ class BitmapImage
          const TextureMode mode = TextureMode::NONE,
          const Color& colorKey = Color::Black);
 
+  /*
+   * Copy a portion of a source view to the destination image
+   * @param src: source view
+   * @param srcRect: source rectangle, relative to the view
+   * @param dstRect: destination rectangle
+   * @param mode: texture mode (NONE, REPEAT, CLAMP, MIRROR, STRETCH)
+   * @param colorKey: color key for transparency
+  */
+  void
+  bitBlt(const ConstImageView& src,
+         const Rect& srcRect,
+         const Rect& dstRect,
+         const TextureMode mode = TextureMode::NONE,
+         const Color& colorKey = Color::Black);
+
+  /*
+   * Resize the image into a view, the result has the size of the view
+   * @param dst: destination view
+   * @param filter: resize filter
+   * @param space: color space of the AREA filter averages, ignored by NEAREST
+  */
+  void
+  resizeInto(ImageView dst,
+             ResizeFilter filter = ResizeFilter::NEAREST,
+             BlendSpace space = BlendSpace::SRGB) const;
+
+  /*
+   * Compare the pixels of this image with another image
+   * @param other: image to compare with, must have the same size and BPP
+   * @param diff: receives the number, first position and bounding box of the differing pixels
+   * @param stopAtFirst: stop at the first differing pixel
+   * @return: true if the images could be compared, false if their size or BPP differ
+  */
+  bool
+  compare(const BitmapImage& other, ImageDiff& diff, bool stopAtFirst = false) const;
+
+  /*
+   * Get a 64-bit hash of the size, BPP and pixels of the image, row padding is ignored
+   * @return: content hash
+  */
+  uint64
+  getContentHash() const;
+
+  /*
+   * Get a 64-bit perceptual hash of the image (dHash)
+   * @return: perceptual hash
+  */
+  uint64
+  getPerceptualHash() const;
+
+  /*
+   * Convert the image to a new RGB565 image
+   * @param dst: destination image, recreated with the size of this image and BPP_16
+   * @param mode: dither mode
+  */
+  void
+  convertTo16Bit(BitmapImage& dst, DitherMode mode = DitherMode::NONE) const;
+
   /*
    * Resize the image
    * @param width: new width of the image
    * @param height: new height of the image
+   * @param filter: resize filter
+   * @param space: color space of the AREA filter averages, ignored by NEAREST
    */
   void
-  resize(uint32 width, uint32 height);
+  resize(uint32 width,
+         uint32 height,
+         ResizeFilter filter = ResizeFilter::NEAREST,
+         BlendSpace space = BlendSpace::SRGB);
 
  private:
 
   /*
-   * Calculate the source coordinates for a given destination coordinate
-   * @param x: x-coordinate of the destination
-   * @param y: y-coordinate of the destination
-   * @param srcRect: source rectangle
-   * @param dstRect: destination rectangle
-   * @param mode: texture mode
-   * @param srcX: x-coordinate of the source
-   * @param srcY: y-coordinate of the source
-   * @return: true if the source coordinates are valid, false otherwise
+   * BlitCoordinates struct
+   * Per-column and per-row source coordinate lookup tables for a bitBlt call.
+   * A negative entry means the destination column/row has no valid source.
   */
-  bool calculateSourceCoordinates(int32 x, int32 y,
-                                  const Rect& srcRect, 
-                                  const Rect& dstRect,
-                                  TextureMode mode,
-                                  int32& srcX, int32& srcY);
+  struct BlitCoordinates
+  {
+    Rect srcRect;
+    Rect dstRect;
+    TextureMode mode;
+    Vector<int32> srcX;
+    Vector<int32> srcY;
+  };
 
   /*
-   * Calculate the source coordinates for a given destination coordinate in REPEAT mode
-   * @param x: x-coordinate of the destination
-   * @param y: y-coordinate of the destination
-   * @param srcRect: source rectangle
-   * @param srcX: x-coordinate of the source
-   * @param srcY: y-coordinate of the source
-   * @return: true if the source coordinates are valid, false otherwise
+   * Get the source coordinate tables for a given blit, building them on a cache miss
+   * @param srcRect: clamped source rectangle
+   * @param dstRect: clamped destination rectangle
+   * @param mode: texture mode
+   * @return: coordinate tables for the blit
   */
-  bool calculateRepeatCoordinates(int32 x, int32 y, 
-                                  const Rect& srcRect,
-                                  int32& srcX, int32& srcY);
+  const BlitCoordinates&
+  getBlitCoordinates(const Rect& srcRect, const Rect& dstRect, TextureMode mode);
 
   /*
-   * Calculate the source coordinates for a given destination coordinate in CLAMP mode
-   * @param x: x-coordinate of the destination
-   * @param y: y-coordinate of the destination
-   * @param srcRect: source rectangle
-   * @param srcX: x-coordinate of the source
-   * @param srcY: y-coordinate of the source
-   * @return: true if the source coordinates are valid, false otherwise
+   * Build the source coordinate table for one axis
+   * @param srcOrigin: origin of the source rectangle on this axis
+   * @param srcSize: size of the source rectangle on this axis
+   * @param dstSize: size of the destination rectangle on this axis
+   * @param mode: texture mode
+   * @param table: output table, one entry per destination coordinate
   */
-  bool calculateClampCoordinates(int32 x, int32 y, 
-                                 const Rect& srcRect,
-                                 int32& srcX, int32& srcY);
+  static void
+  buildCoordinateTable(uint32 srcOrigin,
+                       uint32 srcSize,
+                       uint32 dstSize,
+                       TextureMode mode,
+                       Vector<int32>& table);
 
-  bool calculateMirrorCoordinates(int32 x, int32 y, 
-                                  const Rect& srcRect,
-                                  int32& srcX, int32& srcY);
+  /*
+   * Decode a region of a QOI file, optionally downscaled
+   * @param qoiPath: path to the QOI file
+   * @param region: region of the file to decode, clamped to the file dimensions
+   * @param downscale: integer downscale factor
+   * @param boxFilter: average each downscale x downscale block instead of sampling its top-left pixel
+   * @param space: color space of the box filter averages
+   * @return: true if successful, false otherwise
+  */
+  bool
+  decodeQOI(const std::string& qoiPath,
+            const Rect& region,
+            uint32 downscale,
+            bool boxFilter,
+            BlendSpace space);
 
   /*
-   * Calculate the source coordinates for a given destination coordinate in STRETCH mode
-   * @param x: x-coordinate of the destination
-   * @param y: y-coordinate of the destination
-   * @param srcRect: source rectangle
-   * @param dstRect: destination rectangle
-   * @param srcX: x-coordinate of the source
-   * @param srcY: y-coordinate of the source
-   * @return: true if the source coordinates are valid, false otherwise
+   * Create the image for a decoded region and fill it from rows of the source file
+   * @param srcRect: region of the file, already clamped to the file dimensions
+   * @param bpp: bits per pixel of the rows
+   * @param downscale: integer downscale factor
+   * @param boxFilter: average each downscale x downscale block instead of sampling its top-left pixel
+   * @param space: color space of the box filter averages
+   * @param readRow: returns the srcRect columns of file row y in memory layout, nullptr if the row
+   *                 cannot be read. Rows are requested in increasing order.
+   * @return: true if every needed row could be read, false otherwise
   */
-  bool calculateStretchCoordinates(int32 x, int32 y, 
-                                   const Rect& srcRect, 
-                                   const Rect& dstRect,
-                                   int32& srcX, int32& srcY);
+  bool
+  decodeRows(const Rect& srcRect,
+             BPP bpp,
+             uint32 downscale,
+             bool boxFilter,
+             BlendSpace space,
+             const std::function<const uint8*(uint32 y)>& readRow);
+
+  static constexpr uint32 kBlitCacheSize = 4;
 
+  friend class ImageView;
+  friend class TiledImage;
 
  private:
   uint32 m_width;
   uint32 m_height;
-  uint16 m_pitch;
+  uint32 m_pitch;
   BPP m_bpp; //bits per pixel
   uint8 m_bytesPerPixel; //bytes per pixel
   uint8* m_pixels;
+  Vector<BlitCoordinates> m_blitCache; //most recently used first
 };
\ No newline at end of file
@@ -4,10 +4,12 @@
 #include <vector>
 #include <string>
 
+using int64 = std::int64_t;
 using int32 = std::int32_t;
 using int16 = std::int16_t;
 using int8 = std::int8_t;
 
+using uint64 = std::uint64_t;
 using uint32 = std::uint32_t;
 using uint16 = std::uint16_t;
 using uint8 = std::uint8_t;
@@ -17,3 +19,8 @@ using Byte = std::byte;
 template <typename T>
 using Vector = std::vector<T>;
 
+// SSE2 is the baseline for x86-64, other targets use the scalar paths
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BITMAP_TOOL_SSE2 1
+#endif
+
@@ -12,10 +12,19 @@ struct Rect
   inline void 
   clamp(const Rect& rect)
   {
-      if (x < rect.x) { x = rect.x; }
-      if (y < rect.y) { y = rect.y; }
-      if (x + width > rect.x + rect.width) { width = rect.x + rect.width - x; }
-      if (y + height > rect.y + rect.height) { height = rect.y + rect.height - y; }
+      if (x < rect.x) { width = width > rect.x - x ? width - (rect.x - x) : 0; x = rect.x; }
+      if (y < rect.y) { height = height > rect.y - y ? height - (rect.y - y) : 0; y = rect.y; }
+      // Compare against the space left instead of computing x + width, which can overflow
+      const uint32 right = rect.x + rect.width;
+      const uint32 bottom = rect.y + rect.height;
+      width = x < right ? (width > right - x ? right - x : width) : 0;
+      height = y < bottom ? (height > bottom - y ? bottom - y : height) : 0;
+  }
+
+  inline bool
+  operator==(const Rect& rect) const
+  {
+    return x == rect.x && y == rect.y && width == rect.width && height == rect.height;
   }
 
   uint32 x;
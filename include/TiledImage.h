@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Prerequisites.h"
+#include "Color.h"
+#include "Rect.h"
+#include "Image.h"
+
+/*
+ * TileEncoding enum class
+ * Represents how the pixels of a tile are stored
+*/
+enum class TileEncoding: uint8
+{
+  UNIFORM, //a single pixel value
+  RLE,     //runs, literals and copies from the row above
+  RAW      //uncompressed, used when compression does not pay off
+};
+
+/*
+ * TiledImage class
+ * Bitmap image stored as fixed-size compressed tiles, for large canvases that are mostly
+ * empty or flat color. Tiles are decompressed on demand into a small cache of hot tiles
+ * and compressed back when they are evicted.
+ * Reading pixels updates the tile cache, so a TiledImage must not be used from several threads at once.
+*/
+class TiledImage
+{
+ public:
+  TiledImage() : m_width(0), m_height(0), m_tileSize(kDefaultTileSize), m_tilesX(0), m_tilesY(0), m_bpp(BPP::BPP_32), m_bytesPerPixel(4) {};
+
+  /*
+   * Getters
+  */
+  inline uint32
+  getWidth() const { return m_width; }
+
+  inline uint32
+  getHeight() const { return m_height; }
+
+  inline BPP
+  getBPP() const { return m_bpp; }
+
+  inline uint32
+  getTileSize() const { return m_tileSize; }
+
+  /*
+   * Create a new tiled image, all pixels start as zero bytes (Color::Transparent for 32bpp)
+   * @param width: width of the image
+   * @param height: height of the image
+   * @param bpp: bits per pixel (BPP_16, BPP_24, BPP_32)
+   * @param tileSize: width and height of the tiles
+  */
+  void
+  create(uint32 width, uint32 height, BPP bpp = BPP::BPP_32, uint32 tileSize = kDefaultTileSize);
+
+  /*
+   * Clear the image with a color, every tile becomes uniform
+   * @param color: color to clear the image with
+  */
+  void
+  clear(const Color& color);
+
+  /*
+   * Fill a rectangle of the image with a color, fully covered tiles become uniform
+   * @param rect: rectangle to fill, clamped to the image bounds
+   * @param color: color to fill the rectangle with
+  */
+  void
+  fillRect(const Rect& rect, const Color& color);
+
+  /*
+   * Get the color of a pixel
+   * @param x: x-coordinate of the pixel
+   * @param y: y-coordinate of the pixel
+   * @return: color of the pixel
+  */
+  Color
+  getPixel(uint32 x, uint32 y) const;
+
+  /*
+   * Set the color of a pixel
+   * @param x: x-coordinate of the pixel
+   * @param y: y-coordinate of the pixel
+   * @param color: color to set the pixel with
+  */
+  void
+  setPixel(uint32 x, uint32 y, const Color& color);
+
+  /*
+   * Copy a portion of the source view to this image, tile by tile
+   * @param src: source view
+   * @param srcRect: source rectangle
+   * @param dstRect: destination rectangle
+   * @param mode: texture mode (NONE, REPEAT, CLAMP, MIRROR, STRETCH)
+   * @param colorKey: color key for transparency
+  */
+  void
+  bitBlt(const ConstImageView& src,
+         const Rect& srcRect,
+         const Rect& dstRect,
+         const TextureMode mode = TextureMode::NONE,
+         const Color& colorKey = Color::Black);
+
+  /*
+   * Copy a portion of the source image to this image, tile by tile
+   * @param src: source image
+   * @param srcRect: source rectangle
+   * @param dstRect: destination rectangle
+   * @param mode: texture mode (NONE, REPEAT, CLAMP, MIRROR, STRETCH)
+   * @param colorKey: color key for transparency
+  */
+  void
+  bitBlt(const BitmapImage& src,
+         const Rect& srcRect,
+         const Rect& dstRect,
+         const TextureMode mode = TextureMode::NONE,
+         const Color& colorKey = Color::Black);
+
+  /*
+   * Copy a region of the image into a view
+   * @param rect: region of the image, clamped to the image bounds
+   * @param dst: destination view, must have the same BPP and be at least as large as the region
+  */
+  void
+  copyTo(const Rect& rect, ImageView dst) const;
+
+  /*
+   * Encode the image to a BMP file, or to a QOI file when the name has a .qoi extension,
+   * decompressing one band of tiles at a time
+   * @param filename: name of the BMP file (".bmp" is appended) or of the QOI file
+   * @param topDown: write rows top-down (negative height), ignored for QOI files
+  */
+  void
+  encode(const std::string& filename, bool topDown = false) const;
+
+  /*
+   * Compress every hot tile that was modified
+  */
+  void
+  flush() const;
+
+  /*
+   * Get the number of bytes used by the tiles and the tile cache
+   * @return: memory used in bytes
+  */
+  size_t
+  getMemoryUsage() const;
+
+  static constexpr uint32 kDefaultTileSize = 64;
+
+ private:
+
+  /*
+   * Tile struct
+   * Stored pixels of a tile, color holds the pixel bytes of uniform tiles
+  */
+  struct Tile
+  {
+    TileEncoding encoding;
+    uint8 color[4];
+    Vector<uint8> data;
+  };
+
+  /*
+   * HotTile struct
+   * Decompressed tile in the cache, rows are tightly packed
+  */
+  struct HotTile
+  {
+    uint32 index;
+    bool dirty;
+    Vector<uint8> pixels;
+  };
+
+  /*
+   * Get the rectangle covered by a tile, edge tiles can be smaller than the tile size
+   * @param index: tile index
+   * @return: rectangle of the tile in image coordinates
+  */
+  Rect
+  getTileRect(uint32 index) const;
+
+  /*
+   * Get a view of the decompressed pixels of a tile, loading it into the cache if needed.
+   * The view is valid until the next tile is acquired.
+   * @param index: tile index
+   * @param write: true to mark the tile as modified
+   * @return: view of the whole tile
+  */
+  ImageView
+  acquireTile(uint32 index, bool write) const;
+
+  /*
+   * Copy part of a tile into a view without loading it into the cache
+   * @param index: tile index
+   * @param part: part of the tile, relative to the tile
+   * @param dst: destination view of the size of the part
+  */
+  void
+  readTile(uint32 index, const Rect& part, ImageView dst) const;
+
+  /*
+   * Compress a cached tile back into its storage
+   * @param hot: cached tile
+  */
+  void
+  storeTile(HotTile& hot) const;
+
+  /*
+   * Make a tile uniform, dropping it from the cache
+   * @param index: tile index
+   * @param pixel: pixel bytes of the tile color
+  */
+  void
+  setTileUniform(uint32 index, const uint8* pixel);
+
+  static constexpr uint32 kHotTileCount = 16;
+
+  uint32 m_width;
+  uint32 m_height;
+  uint32 m_tileSize;
+  uint32 m_tilesX;
+  uint32 m_tilesY;
+  BPP m_bpp; //bits per pixel
+  uint8 m_bytesPerPixel; //bytes per pixel
+  mutable Vector<Tile> m_tiles;
+  mutable Vector<HotTile> m_hotTiles; //most recently used first
+};
@@ -0,0 +1,475 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <regex>
+
+#include "Image.h"
+#include "Color.h"
+
+/*
+ * Performance regression harness.
+ * Runs a fixed matrix of workloads, reports the median time per run and its median absolute
+ * deviation (MAD), and compares the medians with a baseline JSON file.
+ * Exit code: 0 when no workload regressed, 1 when at least one did, 2 on invalid arguments or files,
+ * or when the baseline was recorded with a different build type (release or debug).
+*/
+
+namespace PerfHelpers
+{
+// Runs of fast workloads are repeated until a sample takes at least this long
+constexpr double kMinSampleMicroseconds = 5000.0;
+
+// A slowdown also has to exceed this many MADs to count, so noisy workloads do not fail on jitter
+constexpr double kNoiseMADs = 3.0;
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * Workload struct
+ * A named operation, prepare() allocates its inputs and returns the function to time
+*/
+struct Workload
+{
+  std::string name;
+  std::function<std::function<void()>()> prepare;
+};
+
+/*
+ * Stats struct
+ * Timing of a workload, in microseconds per run
+*/
+struct Stats
+{
+  double median = 0.0;
+  double mad = 0.0;
+};
+
+/*
+ * Options struct
+ * Command line options
+*/
+struct Options
+{
+  std::string baselinePath;
+  std::string savePath;
+  std::string filter;
+  double threshold = 10.0; //percent
+  uint32 warmup = 3;
+  uint32 repetitions = 15;
+};
+
+/*
+ */
+inline const char*
+getBuildType()
+{
+#ifdef NDEBUG
+  return "release";
+#else
+  return "debug";
+#endif
+}
+
+/*
+ */
+inline std::string
+bppName(BPP bpp)
+{
+  return std::to_string(static_cast<int>(bpp)) + "bpp";
+}
+
+/*
+ */
+inline std::string
+sizeName(uint32 width, uint32 height)
+{
+  return std::to_string(width) + "x" + std::to_string(height);
+}
+
+/*
+ */
+inline const char*
+modeName(TextureMode mode)
+{
+  switch (mode)
+  {
+    case TextureMode::NONE: return "none";
+    case TextureMode::REPEAT: return "repeat";
+    case TextureMode::CLAMP: return "clamp";
+    case TextureMode::MIRROR: return "mirror";
+    case TextureMode::STRETCH: return "stretch";
+  }
+  return "unknown";
+}
+
+/*
+ * Create an image with a deterministic pattern of gradients and noise, so codecs and
+ * color keys see realistic data
+ */
+std::shared_ptr<BitmapImage>
+makeTestImage(uint32 width, uint32 height, BPP bpp)
+{
+  auto image = std::make_shared<BitmapImage>();
+  image->create(width, height, bpp);
+
+  uint32 noise = 0x12345678u;
+  for (uint32 y = 0; y < height; ++y)
+  {
+    for (uint32 x = 0; x < width; ++x)
+    {
+      noise = noise * 1664525u + 1013904223u;
+      image->setPixel(x, y, Color(static_cast<uint8>(x * 255 / width),
+                                  static_cast<uint8>(y * 255 / height),
+                                  static_cast<uint8>((x ^ y) + (noise >> 29)),
+                                  static_cast<uint8>(255 - (noise >> 30))));
+    }
+  }
+  return image;
+}
+
+/*
+ */
+double
+median(Vector<double> values)
+{
+  std::sort(values.begin(), values.end());
+  const size_t middle = values.size() / 2;
+  return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) * 0.5;
+}
+
+/*
+ * Time a workload: warm-up runs, then repetitions samples of enough runs to last kMinSampleMicroseconds
+ */
+Stats
+measure(const std::function<void()>& run, uint32 warmup, uint32 repetitions)
+{
+  double lastRun = 0.0;
+  for (uint32 i = 0; i < std::max(1u, warmup); ++i)
+  {
+    const auto start = Clock::now();
+    run();
+    lastRun = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  }
+
+  const uint32 runsPerSample = static_cast<uint32>(std::ceil(kMinSampleMicroseconds / std::max(lastRun, 1.0)));
+
+  Vector<double> samples;
+  samples.reserve(repetitions);
+  for (uint32 i = 0; i < repetitions; ++i)
+  {
+    const auto start = Clock::now();
+    for (uint32 j = 0; j < runsPerSample; ++j)
+    {
+      run();
+    }
+    samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count() / runsPerSample);
+  }
+
+  Stats stats;
+  stats.median = median(samples);
+  for (double& sample : samples)
+  {
+    sample = std::abs(sample - stats.median);
+  }
+  stats.mad = median(samples);
+  return stats;
+}
+
+/*
+ * Build the workload matrix
+ * @param tempDir: directory for the files of the codec workloads
+ */
+Vector<Workload>
+buildWorkloads(const std::filesystem::path& tempDir)
+{
+  Vector<Workload> workloads;
+  const BPP formats[] = {BPP::BPP_16, BPP::BPP_24, BPP::BPP_32};
+  const TextureMode modes[] = {TextureMode::NONE, TextureMode::REPEAT, TextureMode::CLAMP,
+                               TextureMode::MIRROR, TextureMode::STRETCH};
+  const uint32 codecSizes[][2] = {{256, 256}, {1920, 1080}};
+
+  for (BPP bpp : formats)
+  {
+    for (const auto& size : codecSizes)
+    {
+      const uint32 width = size[0];
+      const uint32 height = size[1];
+      const std::string suffix = bppName(bpp) + "_" + sizeName(width, height);
+      const std::string path = (tempDir / ("codec_" + suffix)).string();
+
+      workloads.push_back({"encode_" + suffix, [=]()
+      {
+        auto image = makeTestImage(width, height, bpp);
+        return std::function<void()>([image, path]() { image->encode(path); });
+      }});
+
+      workloads.push_back({"decode_" + suffix, [=]()
+      {
+        makeTestImage(width, height, bpp)->encode(path);
+        auto image = std::make_shared<BitmapImage>();
+        return std::function<void()>([image, path]() { image->decode(path + ".bmp"); });
+      }});
+    }
+
+    for (TextureMode mode : modes)
+    {
+      workloads.push_back({std::string("bitblt_") + modeName(mode) + "_" + bppName(bpp), [=]()
+      {
+        auto src = makeTestImage(640, 360, bpp);
+        auto dst = makeTestImage(1920, 1080, bpp);
+        const Rect srcRect(0, 0, src->getWidth(), src->getHeight());
+        const Rect dstRect(0, 0, dst->getWidth(), dst->getHeight());
+        return std::function<void()>([=]() { dst->bitBlt(*src, srcRect, dstRect, mode); });
+      }});
+    }
+
+    workloads.push_back({"resize_up_" + bppName(bpp), [=]()
+    {
+      auto src = makeTestImage(960, 540, bpp);
+      auto dst = std::make_shared<BitmapImage>();
+      dst->create(1920, 1080, bpp);
+      return std::function<void()>([src, dst]() { src->resizeInto(dst->getView()); });
+    }});
+
+    workloads.push_back({"resize_down_" + bppName(bpp), [=]()
+    {
+      auto src = makeTestImage(1920, 1080, bpp);
+      auto dst = std::make_shared<BitmapImage>();
+      dst->create(480, 270, bpp);
+      return std::function<void()>([src, dst]() { src->resizeInto(dst->getView()); });
+    }});
+
+    for (BlendSpace space : {BlendSpace::SRGB, BlendSpace::LINEAR})
+    {
+      const std::string spaceName = space == BlendSpace::LINEAR ? "linear" : "srgb";
+      workloads.push_back({"resize_area_" + spaceName + "_" + bppName(bpp), [=]()
+      {
+        auto src = makeTestImage(1920, 1080, bpp);
+        auto dst = std::make_shared<BitmapImage>();
+        dst->create(480, 270, bpp);
+        return std::function<void()>([src, dst, space]() { src->resizeInto(dst->getView(), ResizeFilter::AREA, space); });
+      }});
+    }
+
+    workloads.push_back({"clear_" + bppName(bpp), [=]()
+    {
+      auto image = std::make_shared<BitmapImage>();
+      image->create(1920, 1080, bpp);
+      return std::function<void()>([image]() { image->clear(Color::Blue); });
+    }});
+  }
+
+  return workloads;
+}
+
+/*
+ * Read a baseline file written by writeBaseline
+ * @return: true if the file could be read
+ */
+bool
+readBaseline(const std::string& path, std::map<std::string, Stats>& results, std::string& buildType)
+{
+  std::ifstream file(path);
+  if (!file.is_open())
+  {
+    std::cerr << "readBaseline() " << "Error: Unable to open file " << path << std::endl;
+    return false;
+  }
+
+  std::stringstream content;
+  content << file.rdbuf();
+  const std::string text = content.str();
+
+  std::smatch match;
+  if (std::regex_search(text, match, std::regex("\"build\"\\s*:\\s*\"(\\w+)\"")))
+  {
+    buildType = match[1];
+  }
+
+  const std::regex entry("\"([^\"]+)\"\\s*:\\s*\\{\\s*\"median_us\"\\s*:\\s*([-+.eE0-9]+)\\s*,"
+                         "\\s*\"mad_us\"\\s*:\\s*([-+.eE0-9]+)\\s*\\}");
+  for (auto it = std::sregex_iterator(text.begin(), text.end(), entry); it != std::sregex_iterator(); ++it)
+  {
+    Stats stats;
+    stats.median = std::strtod((*it)[2].str().c_str(), nullptr);
+    stats.mad = std::strtod((*it)[3].str().c_str(), nullptr);
+    results[(*it)[1]] = stats;
+  }
+
+  if (results.empty())
+  {
+    std::cerr << "readBaseline() " << "Error: No results in " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Write the results as a baseline file
+ * @return: true if the file could be written
+ */
+bool
+writeBaseline(const std::string& path, const Vector<std::pair<std::string, Stats>>& results)
+{
+  std::ofstream file(path);
+  if (!file.is_open())
+  {
+    std::cerr << "writeBaseline() " << "Error: Unable to open file " << path << std::endl;
+    return false;
+  }
+
+  file << "{\n  \"build\": \"" << getBuildType() << "\",\n  \"results\": {\n" << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    file << "    \"" << results[i].first << "\": {\"median_us\": " << results[i].second.median
+         << ", \"mad_us\": " << results[i].second.mad << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  file << "  }\n}\n";
+  return static_cast<bool>(file);
+}
+
+/*
+ */
+void
+printUsage()
+{
+  std::cout << "Usage: PerfRegression [options]\n"
+            << "  --baseline <file>    compare with a baseline JSON file, exit 1 on regressions\n"
+            << "  --save <file>        write the results as a baseline JSON file\n"
+            << "  --threshold <pct>    slowdown in percent that counts as a regression (default 10)\n"
+            << "  --warmup <n>         warm-up runs per workload (default 3)\n"
+            << "  --repetitions <n>    timed samples per workload (default 15)\n"
+            << "  --filter <text>      only run workloads whose name contains text\n";
+}
+
+/*
+ * @return: true if the arguments are valid
+ */
+bool
+parseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h")
+    {
+      return false;
+    }
+    if (i + 1 >= argc)
+    {
+      std::cerr << "parseOptions() " << "Error: Missing value for " << arg << std::endl;
+      return false;
+    }
+
+    const std::string value = argv[++i];
+    if (arg == "--baseline") { options.baselinePath = value; }
+    else if (arg == "--save") { options.savePath = value; }
+    else if (arg == "--filter") { options.filter = value; }
+    else if (arg == "--threshold") { options.threshold = std::strtod(value.c_str(), nullptr); }
+    else if (arg == "--warmup") { options.warmup = static_cast<uint32>(std::strtoul(value.c_str(), nullptr, 10)); }
+    else if (arg == "--repetitions") { options.repetitions = static_cast<uint32>(std::strtoul(value.c_str(), nullptr, 10)); }
+    else
+    {
+      std::cerr << "parseOptions() " << "Error: Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+
+  if (options.repetitions == 0 || options.threshold <= 0.0)
+  {
+    std::cerr << "parseOptions() " << "Error: repetitions and threshold must be positive" << std::endl;
+    return false;
+  }
+  return true;
+}
+}
+
+int main(int argc, char** argv)
+{
+  using namespace PerfHelpers;
+
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    printUsage();
+    return 2;
+  }
+
+  std::map<std::string, Stats> baseline;
+  std::string baselineBuild;
+  if (!options.baselinePath.empty() && !readBaseline(options.baselinePath, baseline, baselineBuild))
+  {
+    return 2;
+  }
+  // Timings of different build types are not comparable, every workload would be reported
+  if (!options.baselinePath.empty() && baselineBuild != getBuildType())
+  {
+    std::cerr << "Error: baseline was recorded with a " << (baselineBuild.empty() ? "unknown" : baselineBuild)
+              << " build, this is a " << getBuildType() << " build" << std::endl;
+    return 2;
+  }
+
+  const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "bitmaptool_perf";
+  std::filesystem::create_directories(tempDir);
+
+  const double limit = 1.0 + options.threshold / 100.0;
+  Vector<std::pair<std::string, Stats>> results;
+  uint32 regressions = 0;
+
+  std::cout << std::left << std::setw(32) << "workload" << std::right << std::setw(14) << "median us"
+            << std::setw(12) << "mad us" << std::setw(14) << "baseline us" << std::setw(10) << "change" << "\n";
+  std::cout << std::fixed << std::setprecision(1);
+
+  for (const Workload& workload : buildWorkloads(tempDir))
+  {
+    if (workload.name.find(options.filter) == std::string::npos)
+    {
+      continue;
+    }
+
+    const Stats stats = measure(workload.prepare(), options.warmup, options.repetitions);
+    results.emplace_back(workload.name, stats);
+
+    std::cout << std::left << std::setw(32) << workload.name << std::right << std::setw(14) << stats.median
+              << std::setw(12) << stats.mad;
+
+    auto it = baseline.find(workload.name);
+    if (it == baseline.end())
+    {
+      std::cout << std::setw(14) << "-" << std::setw(10) << "new" << "\n";
+      continue;
+    }
+
+    const Stats& base = it->second;
+    const double change = (stats.median / base.median - 1.0) * 100.0;
+    const bool regressed = stats.median > base.median * limit &&
+                           stats.median - base.median > kNoiseMADs * std::max(stats.mad, base.mad);
+    regressions += regressed ? 1 : 0;
+
+    std::cout << std::setw(14) << base.median << std::setw(9) << std::showpos << change << std::noshowpos << "%"
+              << (regressed ? "  REGRESSION" : "") << "\n";
+  }
+
+  std::filesystem::remove_all(tempDir);
+
+  if (!options.savePath.empty() && !writeBaseline(options.savePath, results))
+  {
+    return 2;
+  }
+
+  if (!baseline.empty())
+  {
+    std::cout << regressions << " regression(s) above " << options.threshold << "%" << std::endl;
+  }
+  return regressions > 0 ? 1 : 0;
+}
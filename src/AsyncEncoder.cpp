@@ -0,0 +1,182 @@
+#include "AsyncEncoder.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ */
+AsyncEncoder::AsyncEncoder(uint32 maxQueued, uint32 syncEvery)
+  : m_maxQueued(std::max(1u, maxQueued)),
+    m_syncEvery(syncEvery),
+    m_stop(false),
+    m_writing(false),
+    m_reserved(0),
+    m_writer(&AsyncEncoder::writerLoop, this)
+{}
+
+/*
+ */
+AsyncEncoder::~AsyncEncoder()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_queueChanged.notify_all();
+  m_writer.join();
+}
+
+/*
+ */
+std::future<bool>
+AsyncEncoder::encode(const BitmapImage &image, const std::string &filename, bool topDown)
+{
+  return encode(image.getView(), filename, topDown);
+}
+
+/*
+ */
+std::future<bool>
+AsyncEncoder::encode(const ConstImageView &image, const std::string &filename, bool topDown)
+{
+  Job job;
+  job.filename = filename;
+  job.width = image.getWidth();
+  job.height = image.getHeight();
+  job.bpp = image.getBPP();
+  job.topDown = topDown;
+  std::future<bool> result = job.result.get_future();
+
+  if (image.isEmpty())
+  {
+    std::cerr << "AsyncEncoder::encode() " << "Error: Empty image" << std::endl;
+    job.result.set_value(false);
+    return result;
+  }
+
+  // Reserve the queue slot before copying, so concurrent producers cannot both take the last one
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_queueChanged.wait(lock, [this]() { return m_queue.size() + m_reserved < m_maxQueued; });
+  ++m_reserved;
+
+  if (!m_bufferPool.empty())
+  {
+    job.pixels = std::move(m_bufferPool.back());
+    m_bufferPool.pop_back();
+  }
+  lock.unlock();
+
+  // Snapshot the rows tightly packed so the writer can do a single contiguous write
+  const size_t rowBytes = static_cast<size_t>(job.width) * image.getBytesPerPixel();
+  job.pixels.resize(rowBytes * job.height);
+  for (uint32 y = 0; y < job.height; ++y)
+  {
+    std::memcpy(job.pixels.data() + y * rowBytes, image.getRow(y), rowBytes);
+  }
+
+  lock.lock();
+  --m_reserved;
+  m_queue.push_back(std::move(job));
+  lock.unlock();
+  m_queueChanged.notify_all();
+
+  return result;
+}
+
+/*
+ */
+void
+AsyncEncoder::flush()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_queueChanged.wait(lock, [this]() { return m_queue.empty() && m_reserved == 0 && !m_writing; });
+}
+
+/*
+ */
+void
+AsyncEncoder::writerLoop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    m_queueChanged.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+    if (m_queue.empty())
+    {
+      break;
+    }
+
+    // Keep the job in the queue until it is written, it still counts against maxQueued
+    Job &job = m_queue.front();
+    const bool lastQueued = m_queue.size() == 1;
+    m_writing = true;
+    lock.unlock();
+
+    const size_t rowBytes = job.pixels.size() / job.height;
+    const uint8 *pixels = job.pixels.data();
+    auto getRow = [pixels, rowBytes](uint32 y) { return pixels + y * rowBytes; };
+    const bool qoi = isQOIFile(job.filename);
+    const bool success = qoi ? encodeQOI(job.filename, job.width, job.height, job.bpp, getRow)
+                             : encodeBMP(job.filename, job.width, job.height, job.bpp, job.topDown, getRow, pixels);
+
+    // Written files resolve their future once they are synced, failures resolve right away
+    if (success && m_syncEvery > 0)
+    {
+      m_pendingSync.push_back({qoi ? job.filename : job.filename + ".bmp", std::move(job.result)});
+    }
+    else
+    {
+      job.result.set_value(success);
+    }
+
+    // Sync full batches, or whatever is pending once the queue runs dry
+    if (!m_pendingSync.empty() && (m_pendingSync.size() >= m_syncEvery || lastQueued))
+    {
+      syncPending();
+    }
+
+    lock.lock();
+    m_bufferPool.push_back(std::move(job.pixels));
+    m_queue.pop_front();
+    m_writing = false;
+    m_queueChanged.notify_all();
+  }
+}
+
+/*
+ */
+void
+AsyncEncoder::syncPending()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  for (PendingSync &pending : m_pendingSync)
+  {
+    const int fd = ::open(pending.path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      std::cerr << "AsyncEncoder::syncPending() " << "Error: Unable to open file " << pending.path << std::endl;
+      pending.result.set_value(false);
+      continue;
+    }
+#if defined(__linux__)
+    const bool synced = ::fdatasync(fd) == 0;
+#else
+    const bool synced = ::fsync(fd) == 0;
+#endif
+    ::close(fd);
+    pending.result.set_value(synced);
+  }
+#else
+  for (PendingSync &pending : m_pendingSync)
+  {
+    pending.result.set_value(true);
+  }
+#endif
+  m_pendingSync.clear();
+}
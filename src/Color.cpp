@@ -1,5 +1,48 @@
 #include "Color.h"
 
+#include <cmath>
+
+//Ref: https://www.w3.org/Graphics/Color/srgb
+
+namespace ColorHelpers
+{
+/*
+ * SRGBTables struct
+ * Lookup tables between sRGB and linear light channels, built once on first use
+ */
+struct SRGBTables
+{
+  SRGBTables()
+  {
+    for (uint32 i = 0; i < 256; ++i)
+    {
+      const double c = i / 255.0;
+      const double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+      toLinear[i] = static_cast<uint16>(std::lround(linear * Color::kLinearMax));
+    }
+
+    for (uint32 i = 0; i <= Color::kLinearMax; ++i)
+    {
+      const double linear = static_cast<double>(i) / Color::kLinearMax;
+      const double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+      toSRGB[i] = static_cast<uint8>(std::lround(c * 255));
+    }
+  }
+
+  uint16 toLinear[256];
+  uint8 toSRGB[Color::kLinearMax + 1];
+};
+
+/*
+ */
+const SRGBTables&
+getTables()
+{
+  static const SRGBTables tables;
+  return tables;
+}
+}
+
 const Color Color::Black(0, 0, 0);
 const Color Color::Transparent(0, 0, 0, 0);
 const Color Color::White(255, 255, 255);
@@ -10,44 +53,54 @@ const Color Color::Blue(0, 0, 255);
 uint16
 Color::to16Bit(bool isRGB565) const
 {
-  const float RGB555 =  31 / 255;
-  const float RGB565 =  63 / 255;
+  // Scale each channel to the nearest 5 or 6 bit value
+  const uint16 r5 = static_cast<uint16>((r * 31 + 127) / 255);
+  const uint16 b5 = static_cast<uint16>((b * 31 + 127) / 255);
   if (isRGB565)
   {
-    uint8 r = r * RGB555;
-    uint8 g = g * RGB565;
-    uint8 b = b * RGB555;
-    return (r << 11) | (g << 5) | b;
+    const uint16 g6 = static_cast<uint16>((g * 63 + 127) / 255);
+    return (r5 << 11) | (g6 << 5) | b5;
   }
   else
   {
-    uint8 r = r * RGB555;
-    uint8 g = g * RGB555;
-    uint8 b = b * RGB555;
-    return (r << 10) | (g << 5) | b;
+    const uint16 g5 = static_cast<uint16>((g * 31 + 127) / 255);
+    return (r5 << 10) | (g5 << 5) | b5;
   }
 }
 
 Color 
 Color::from16Bit(uint16_t value, bool isRGB565)
 {
-  Color color;
-  const float RGB555 =  255 / 31;
-  const float RGB565 =  255 / 63;
+  // Expand by bit replication so 0 maps to 0 and the maximum maps to 255
+  auto expand5 = [](uint32 v) { return static_cast<uint8>((v << 3) | (v >> 2)); };
+  auto expand6 = [](uint32 v) { return static_cast<uint8>((v << 2) | (v >> 4)); };
 
+  Color color;
   if (isRGB565)
   {
-    color.r = ((value >> 11) & 0x1F) * RGB555;
-    color.g = ((value >> 5) & 0x3F) * RGB565;
-    color.b = (value & 0x1F) * RGB555;
+    color.r = expand5((value >> 11) & 0x1F);
+    color.g = expand6((value >> 5) & 0x3F);
+    color.b = expand5(value & 0x1F);
   }
   else
   {
-    color.r = ((value >> 10) & 0x1F) * RGB555;
-    color.g = ((value >> 5) & 0x1F) * RGB555;
-    color.b = (value & 0x1F) * RGB555;
+    color.r = expand5((value >> 10) & 0x1F);
+    color.g = expand5((value >> 5) & 0x1F);
+    color.b = expand5(value & 0x1F);
   }
 
   color.a = 255;
   return color;
 }
+
+const uint16*
+Color::getLinearTable()
+{
+  return ColorHelpers::getTables().toLinear;
+}
+
+const uint8*
+Color::getSRGBTable()
+{
+  return ColorHelpers::getTables().toSRGB;
+}
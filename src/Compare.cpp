@@ -0,0 +1,423 @@
+#include "Image.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <bitset>
+
+#if BITMAP_TOOL_SSE2
+#include <emmintrin.h>
+#endif
+
+//Ref: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+namespace CompareHelpers
+{
+constexpr uint64 kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64 kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64 kPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64 kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64 kPrime5 = 0x27D4EB2F165667C5ull;
+
+// Size of the downscaled luma grid of the perceptual hash, one extra column for the horizontal gradient
+constexpr uint32 kHashColumns = 9;
+constexpr uint32 kHashRows = 8;
+
+/*
+ */
+inline uint64
+rotateLeft(uint64 value, uint32 bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+/*
+ * Multi-byte values are read in host order, which is little-endian on every target we build for
+ */
+inline uint64
+read64(const uint8 *data)
+{
+  uint64 value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+/*
+ */
+inline uint32
+read32(const uint8 *data)
+{
+  uint32 value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+/*
+ */
+inline uint64
+round(uint64 accumulator, uint64 input)
+{
+  accumulator += input * kPrime2;
+  accumulator = rotateLeft(accumulator, 31);
+  return accumulator * kPrime1;
+}
+
+/*
+ */
+inline uint64
+mergeRound(uint64 accumulator, uint64 value)
+{
+  accumulator ^= round(0, value);
+  return accumulator * kPrime1 + kPrime4;
+}
+
+/*
+ * StreamHasher class
+ * XXH64 over data fed in pieces, the result does not depend on how the data is split
+ */
+class StreamHasher
+{
+ public:
+  explicit StreamHasher(uint64 seed)
+    : m_v{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1},
+      m_seed(seed),
+      m_totalLength(0),
+      m_bufferSize(0)
+  {}
+
+  /*
+   */
+  void
+  update(const uint8 *data, size_t length)
+  {
+    m_totalLength += length;
+
+    if (m_bufferSize > 0)
+    {
+      const size_t take = std::min(length, sizeof(m_buffer) - m_bufferSize);
+      std::memcpy(m_buffer + m_bufferSize, data, take);
+      m_bufferSize += take;
+      data += take;
+      length -= take;
+      if (m_bufferSize < sizeof(m_buffer))
+      {
+        return;
+      }
+      consumeStripe(m_buffer);
+      m_bufferSize = 0;
+    }
+
+    for (; length >= sizeof(m_buffer); data += sizeof(m_buffer), length -= sizeof(m_buffer))
+    {
+      consumeStripe(data);
+    }
+
+    std::memcpy(m_buffer, data, length);
+    m_bufferSize = length;
+  }
+
+  /*
+   */
+  uint64
+  digest() const
+  {
+    uint64 hash;
+    if (m_totalLength >= sizeof(m_buffer))
+    {
+      hash = rotateLeft(m_v[0], 1) + rotateLeft(m_v[1], 7) + rotateLeft(m_v[2], 12) + rotateLeft(m_v[3], 18);
+      for (uint64 v : m_v)
+      {
+        hash = mergeRound(hash, v);
+      }
+    }
+    else
+    {
+      hash = m_seed + kPrime5;
+    }
+    hash += m_totalLength;
+
+    const uint8 *data = m_buffer;
+    size_t length = m_bufferSize;
+    for (; length >= 8; data += 8, length -= 8)
+    {
+      hash ^= round(0, read64(data));
+      hash = rotateLeft(hash, 27) * kPrime1 + kPrime4;
+    }
+    if (length >= 4)
+    {
+      hash ^= static_cast<uint64>(read32(data)) * kPrime1;
+      hash = rotateLeft(hash, 23) * kPrime2 + kPrime3;
+      data += 4;
+      length -= 4;
+    }
+    for (; length > 0; ++data, --length)
+    {
+      hash ^= *data * kPrime5;
+      hash = rotateLeft(hash, 11) * kPrime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+ private:
+  /*
+   */
+  inline void
+  consumeStripe(const uint8 *stripe)
+  {
+    m_v[0] = round(m_v[0], read64(stripe));
+    m_v[1] = round(m_v[1], read64(stripe + 8));
+    m_v[2] = round(m_v[2], read64(stripe + 16));
+    m_v[3] = round(m_v[3], read64(stripe + 24));
+  }
+
+  uint64 m_v[4];
+  uint64 m_seed;
+  uint64 m_totalLength;
+  uint8 m_buffer[32];
+  size_t m_bufferSize;
+};
+
+/*
+ * Find the first byte in [offset, length) that differs between two rows
+ * @return: index of the byte, length if the rows are equal from offset on
+ */
+inline size_t
+findMismatch(const uint8 *a, const uint8 *b, size_t offset, size_t length)
+{
+#if BITMAP_TOOL_SSE2
+  for (; offset + 16 <= length; offset += 16)
+  {
+    const __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + offset)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + offset)));
+    if (_mm_movemask_epi8(equal) != 0xFFFF)
+    {
+      break;
+    }
+  }
+#else
+  for (; offset + 8 <= length; offset += 8)
+  {
+    if (read64(a + offset) != read64(b + offset))
+    {
+      break;
+    }
+  }
+#endif
+
+  for (; offset < length; ++offset)
+  {
+    if (a[offset] != b[offset])
+    {
+      break;
+    }
+  }
+  return offset;
+}
+
+/*
+ * Luma of a pixel, scaled by 256
+ */
+inline uint32
+readLuma(const uint8 *pixel, BPP bpp)
+{
+  if (bpp == BPP::BPP_16)
+  {
+    const Color color = Color::from16Bit(static_cast<uint16>(pixel[0] | (pixel[1] << 8)));
+    return color.r * 77u + color.g * 150u + color.b * 29u;
+  }
+  return pixel[2] * 77u + pixel[1] * 150u + pixel[0] * 29u;
+}
+
+/*
+ * Split size into count ranges of almost equal size, ranges overlap when size is smaller than count
+ */
+inline void
+splitRange(uint32 size, uint32 count, uint32 *begin, uint32 *end)
+{
+  for (uint32 i = 0; i < count; ++i)
+  {
+    begin[i] = static_cast<uint32>(static_cast<uint64>(i) * size / count);
+    end[i] = std::max(static_cast<uint32>(static_cast<uint64>(i + 1) * size / count), begin[i] + 1);
+  }
+}
+}
+
+/*
+ */
+bool
+ConstImageView::compare(const ConstImageView &other, ImageDiff &diff, bool stopAtFirst) const
+{
+  using namespace CompareHelpers;
+
+  diff = ImageDiff();
+  if (m_width != other.m_width || m_height != other.m_height || m_bpp != other.m_bpp)
+  {
+    std::cerr << "ConstImageView::compare() " << "Error: Views differ in size or BPP ("
+              << m_width << "x" << m_height << "x" << static_cast<int>(m_bpp) << " vs "
+              << other.m_width << "x" << other.m_height << "x" << static_cast<int>(other.m_bpp) << ")" << std::endl;
+    return false;
+  }
+  if (isEmpty())
+  {
+    return true;
+  }
+
+  const size_t rowBytes = static_cast<size_t>(m_width) * m_bytesPerPixel;
+  uint32 minX = m_width;
+  uint32 maxX = 0;
+  uint32 minY = m_height;
+  uint32 maxY = 0;
+
+  for (uint32 y = 0; y < m_height; ++y)
+  {
+    const uint8 *a = getRow(y);
+    const uint8 *b = other.getRow(y);
+
+    size_t offset = 0;
+    while ((offset = findMismatch(a, b, offset, rowBytes)) < rowBytes)
+    {
+      const uint32 x = static_cast<uint32>(offset / m_bytesPerPixel);
+      if (diff.count++ == 0)
+      {
+        diff.firstX = x;
+        diff.firstY = y;
+        minY = y;
+      }
+      minX = std::min(minX, x);
+      maxX = std::max(maxX, x);
+      maxY = y;
+
+      if (stopAtFirst)
+      {
+        diff.bounds = Rect(x, y, 1, 1);
+        return true;
+      }
+
+      // Continue after the differing pixel so each pixel is counted once
+      offset = static_cast<size_t>(x + 1) * m_bytesPerPixel;
+    }
+  }
+
+  if (diff.count > 0)
+  {
+    diff.bounds = Rect(minX, minY, maxX - minX + 1, maxY - minY + 1);
+  }
+  return true;
+}
+
+/*
+ */
+uint64
+ConstImageView::getContentHash() const
+{
+  using namespace CompareHelpers;
+
+  // The size and format are part of the key, images with the same bytes but a different shape must not collide
+  const uint32 header[3] = {m_width, m_height, static_cast<uint32>(m_bpp)};
+  StreamHasher hasher(0);
+  hasher.update(reinterpret_cast<const uint8 *>(header), sizeof(header));
+
+  if (!isEmpty())
+  {
+    const size_t rowBytes = static_cast<size_t>(m_width) * m_bytesPerPixel;
+    if (m_stride == rowBytes)
+    {
+      hasher.update(m_pixels, rowBytes * m_height);
+    }
+    else
+    {
+      for (uint32 y = 0; y < m_height; ++y)
+      {
+        hasher.update(getRow(y), rowBytes);
+      }
+    }
+  }
+
+  return hasher.digest();
+}
+
+/*
+ */
+uint64
+ConstImageView::getPerceptualHash() const
+{
+  using namespace CompareHelpers;
+
+  if (isEmpty())
+  {
+    return 0;
+  }
+
+  uint32 columnBegin[kHashColumns], columnEnd[kHashColumns];
+  uint32 rowBegin[kHashRows], rowEnd[kHashRows];
+  splitRange(m_width, kHashColumns, columnBegin, columnEnd);
+  splitRange(m_height, kHashRows, rowBegin, rowEnd);
+
+  uint64 hash = 0;
+  for (uint32 cellY = 0; cellY < kHashRows; ++cellY)
+  {
+    uint64 sums[kHashColumns] = {};
+    for (uint32 y = rowBegin[cellY]; y < rowEnd[cellY]; ++y)
+    {
+      const uint8 *row = getRow(y);
+      for (uint32 cellX = 0; cellX < kHashColumns; ++cellX)
+      {
+        uint64 rowSum = 0;
+        const uint8 *pixel = row + static_cast<size_t>(columnBegin[cellX]) * m_bytesPerPixel;
+        for (uint32 x = columnBegin[cellX]; x < columnEnd[cellX]; ++x, pixel += m_bytesPerPixel)
+        {
+          rowSum += readLuma(pixel, m_bpp);
+        }
+        sums[cellX] += rowSum;
+      }
+    }
+
+    // Compare the cell averages (the cells of a row share their height), cross-multiplied to stay in integers
+    for (uint32 cellX = 0; cellX + 1 < kHashColumns; ++cellX)
+    {
+      const uint64 left = sums[cellX] * (columnEnd[cellX + 1] - columnBegin[cellX + 1]);
+      const uint64 right = sums[cellX + 1] * (columnEnd[cellX] - columnBegin[cellX]);
+      hash = (hash << 1) | (left > right ? 1 : 0);
+    }
+  }
+
+  return hash;
+}
+
+/*
+ */
+uint32
+perceptualDistance(uint64 a, uint64 b)
+{
+  return static_cast<uint32>(std::bitset<64>(a ^ b).count());
+}
+
+/*
+ */
+bool
+BitmapImage::compare(const BitmapImage &other, ImageDiff &diff, bool stopAtFirst) const
+{
+  return getView().compare(other.getView(), diff, stopAtFirst);
+}
+
+/*
+ */
+uint64
+BitmapImage::getContentHash() const
+{
+  return getView().getContentHash();
+}
+
+/*
+ */
+uint64
+BitmapImage::getPerceptualHash() const
+{
+  return getView().getPerceptualHash();
+}
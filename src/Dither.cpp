@@ -0,0 +1,339 @@
+#include "Image.h"
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#if BITMAP_TOOL_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace DitherHelpers
+{
+// 8x8 Bayer threshold matrix, values in [0, 64)
+const uint8 kBayer8x8[8][8] =
+{
+  { 0, 32,  8, 40,  2, 34, 10, 42},
+  {48, 16, 56, 24, 50, 18, 58, 26},
+  {12, 44,  4, 36, 14, 46,  6, 38},
+  {60, 28, 52, 20, 62, 30, 54, 22},
+  { 3, 35, 11, 43,  1, 33,  9, 41},
+  {51, 19, 59, 27, 49, 17, 57, 25},
+  {15, 47,  7, 39, 13, 45,  5, 37},
+  {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// Floyd-Steinberg rows waiting on the previous row check its progress once per chunk of pixels
+constexpr uint32 kWavefrontChunk = 64;
+
+// Images with fewer pixels than this are error diffused on the calling thread
+constexpr uint32 kParallelDitherThreshold = 256 * 1024;
+
+/*
+ */
+inline uint16
+pack16(uint32 r, uint32 g, uint32 b, bool isRGB565)
+{
+  return static_cast<uint16>(isRGB565 ? (r << 11) | (g << 5) | b : (r << 10) | (g << 5) | b);
+}
+
+/*
+ * Nearest quantization tables, the level for each 8-bit value and the error left after expanding it back
+ */
+struct QuantizeTable
+{
+  QuantizeTable(uint32 bits)
+  {
+    const uint32 maxLevel = (1u << bits) - 1;
+    for (uint32 v = 0; v < 256; ++v)
+    {
+      const uint32 q = (v * maxLevel + 127) / 255;
+      const uint32 expanded = (q << (8 - bits)) | (q >> (2 * bits - 8));
+      level[v] = static_cast<uint8>(q);
+      error[v] = static_cast<int16>(static_cast<int32>(v) - static_cast<int32>(expanded));
+    }
+  }
+
+  uint8 level[256];
+  int16 error[256];
+};
+
+const QuantizeTable kQuantize5(5);
+const QuantizeTable kQuantize6(6);
+
+/*
+ * Convert a row of 24/32bpp pixels to the nearest 16-bit colors
+ */
+void
+convertRowNearest(const uint8 *src, uint32 bytesPerPixel, uint16 *dst, uint32 width, bool isRGB565)
+{
+  const QuantizeTable &green = isRGB565 ? kQuantize6 : kQuantize5;
+  for (uint32 x = 0; x < width; ++x, src += bytesPerPixel)
+  {
+    dst[x] = pack16(kQuantize5.level[src[2]], green.level[src[1]], kQuantize5.level[src[0]], isRGB565);
+  }
+}
+
+/*
+ * Convert a row of RGB565 pixels, RGB555 output drops the lowest green bit
+ */
+void
+convertRow16(const uint8 *src, uint16 *dst, uint32 width, bool isRGB565)
+{
+  if (isRGB565)
+  {
+    std::copy_n(reinterpret_cast<const uint16 *>(src), width, dst);
+    return;
+  }
+
+  const uint16 *pixels = reinterpret_cast<const uint16 *>(src);
+  for (uint32 x = 0; x < width; ++x)
+  {
+    dst[x] = static_cast<uint16>(((pixels[x] >> 1) & 0x7FE0) | (pixels[x] & 0x1F));
+  }
+}
+
+/*
+ * Ordered dither a row of 24/32bpp pixels.
+ * Each channel is first scaled by about (2^bits - 1) / 2^bits with a shift, then the threshold is added
+ * with saturation and the low bits are dropped. Averaged over the matrix this reproduces the original
+ * value once the level is expanded back by bit replication.
+ */
+void
+ditherOrderedRow(const uint8 *src, uint32 bytesPerPixel, uint16 *dst, uint32 width, uint32 y, bool isRGB565)
+{
+  const uint8 *bayer = kBayer8x8[y & 7];
+  const uint32 greenShift = isRGB565 ? 2 : 3;
+  const uint32 greenScaleShift = isRGB565 ? 6 : 5;
+  uint32 x = 0;
+
+#if BITMAP_TOOL_SSE2
+  if (bytesPerPixel == 4)
+  {
+    // Per byte thresholds for 8 BGRA pixels, a step is 8 for 5-bit channels and 4 for 6-bit channels
+    alignas(16) uint8 bias[32];
+    for (uint32 i = 0; i < 8; ++i)
+    {
+      bias[i * 4 + 0] = bayer[i] >> 3;
+      bias[i * 4 + 1] = bayer[i] >> (isRGB565 ? 4 : 3);
+      bias[i * 4 + 2] = bayer[i] >> 3;
+      bias[i * 4 + 3] = 0;
+    }
+    const __m128i bias0 = _mm_load_si128(reinterpret_cast<const __m128i *>(bias));
+    const __m128i bias1 = _mm_load_si128(reinterpret_cast<const __m128i *>(bias + 16));
+
+    // Per byte masks of the channels scaled by c - (c >> 5) and by c - (c >> 6)
+    const __m128i scale5Mask = _mm_set1_epi32(isRGB565 ? 0x00070007 : 0x00070707);
+    const __m128i scale6Mask = _mm_set1_epi32(isRGB565 ? 0x00000300 : 0);
+    auto scale = [&](__m128i p)
+    {
+      const __m128i c5 = _mm_and_si128(_mm_srli_epi16(p, 5), scale5Mask);
+      const __m128i c6 = _mm_and_si128(_mm_srli_epi16(p, 6), scale6Mask);
+      return _mm_subs_epu8(p, _mm_or_si128(c5, c6));
+    };
+
+    // Shifts and masks that move the top bits of B, G and R of a 32-bit BGRA lane into place
+    const __m128i redMask = _mm_set1_epi32(isRGB565 ? 0xF800 : 0x7C00);
+    const __m128i greenMask = _mm_set1_epi32(isRGB565 ? 0x07E0 : 0x03E0);
+    const __m128i blueMask = _mm_set1_epi32(0x001F);
+    const __m128i redShift = _mm_cvtsi32_si128(isRGB565 ? 8 : 9);
+    const __m128i greenShiftV = _mm_cvtsi32_si128(isRGB565 ? 5 : 6);
+    const __m128i signBias32 = _mm_set1_epi32(0x8000);
+    const __m128i signBias16 = _mm_set1_epi16(static_cast<int16>(0x8000));
+
+    auto pack = [&](__m128i p)
+    {
+      __m128i r = _mm_and_si128(_mm_srl_epi32(p, redShift), redMask);
+      __m128i g = _mm_and_si128(_mm_srl_epi32(p, greenShiftV), greenMask);
+      __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), blueMask);
+      // Offset to the signed range so the signed saturating pack keeps all 16 bits
+      return _mm_sub_epi32(_mm_or_si128(_mm_or_si128(r, g), b), signBias32);
+    };
+
+    for (; x + 8 <= width; x += 8)
+    {
+      const __m128i p0 = _mm_adds_epu8(scale(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4))), bias0);
+      const __m128i p1 = _mm_adds_epu8(scale(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 4 + 16))), bias1);
+      const __m128i packed = _mm_xor_si128(_mm_packs_epi32(pack(p0), pack(p1)), signBias16);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), packed);
+    }
+  }
+#endif
+
+  for (; x < width; ++x)
+  {
+    const uint8 *pixel = src + x * bytesPerPixel;
+    const uint32 threshold = bayer[x & 7];
+    const uint32 b = std::min(255u, pixel[0] - (pixel[0] >> 5) + (threshold >> 3)) >> 3;
+    const uint32 g = std::min(255u, pixel[1] - (pixel[1] >> greenScaleShift) + (threshold >> (isRGB565 ? 4 : 3))) >> greenShift;
+    const uint32 r = std::min(255u, pixel[2] - (pixel[2] >> 5) + (threshold >> 3)) >> 3;
+    dst[x] = pack16(r, g, b, isRGB565);
+  }
+}
+
+/*
+ * Floyd-Steinberg dither of a whole view.
+ * Error rows hold B, G and R errors in 1/16 units with one guard pixel on each side.
+ * Rows are dealt round robin to the worker threads, a row may process pixel x once the
+ * previous row is past x + 1, since that is the last pixel spreading error onto x.
+ */
+void
+ditherFloydSteinberg(const ConstImageView &src, ImageView &dst, uint32 width, uint32 height, bool isRGB565)
+{
+  uint32 threadCount = 1;
+  if (static_cast<size_t>(width) * height >= kParallelDitherThreshold)
+  {
+    threadCount = std::min(std::max(1u, std::thread::hardware_concurrency()), height);
+  }
+
+  // Rows r and r + 1 use error rows r % ringSize and (r + 1) % ringSize, by the time a row reuses
+  // an error row every row that touched it before has been completed
+  const uint32 ringSize = 2 * threadCount;
+  const size_t errorRowSize = (static_cast<size_t>(width) + 2) * 3;
+  Vector<int16> errors(errorRowSize * ringSize, 0);
+  Vector<std::atomic<uint32>> progress(height);
+  for (std::atomic<uint32> &rowProgress : progress)
+  {
+    rowProgress.store(0, std::memory_order_relaxed);
+  }
+
+  const QuantizeTable &green = isRGB565 ? kQuantize6 : kQuantize5;
+  const QuantizeTable *tables[3] = {&kQuantize5, &green, &kQuantize5};
+  const uint32 bytesPerPixel = src.getBytesPerPixel();
+
+  auto ditherRow = [&](uint32 y)
+  {
+    const int16 *errorIn = errors.data() + (y % ringSize) * errorRowSize;
+    int16 *errorOut = errors.data() + ((y + 1) % ringSize) * errorRowSize;
+    std::fill(errorOut, errorOut + errorRowSize, static_cast<int16>(0));
+
+    const uint8 *srcRow = src.getRow(y);
+    uint16 *dstRow = reinterpret_cast<uint16 *>(dst.getRow(y));
+    int32 carry[3] = {0, 0, 0};
+
+    for (uint32 chunk = 0; chunk < width; chunk += kWavefrontChunk)
+    {
+      const uint32 chunkEnd = std::min(chunk + kWavefrontChunk, width);
+      if (y > 0)
+      {
+        const uint32 needed = std::min(chunkEnd + 1, width);
+        while (progress[y - 1].load(std::memory_order_acquire) < needed)
+        {
+          std::this_thread::yield();
+        }
+      }
+
+      for (uint32 x = chunk; x < chunkEnd; ++x)
+      {
+        const uint8 *pixel = srcRow + x * bytesPerPixel;
+        uint32 levels[3];
+        for (uint32 c = 0; c < 3; ++c)
+        {
+          const int32 index = static_cast<int32>((x + 1) * 3 + c);
+          const int32 value = std::min(255, std::max(0, pixel[c] + ((errorIn[index] + carry[c] * 7 + 8) >> 4)));
+          const int32 error = tables[c]->error[value];
+          levels[c] = tables[c]->level[value];
+
+          carry[c] = error;
+          errorOut[index - 3] += static_cast<int16>(error * 3);
+          errorOut[index] += static_cast<int16>(error * 5);
+          errorOut[index + 3] += static_cast<int16>(error);
+        }
+        dstRow[x] = pack16(levels[2], levels[1], levels[0], isRGB565);
+      }
+
+      progress[y].store(chunkEnd, std::memory_order_release);
+    }
+  };
+
+  auto worker = [&](uint32 first)
+  {
+    for (uint32 y = first; y < height; y += threadCount)
+    {
+      ditherRow(y);
+    }
+  };
+
+  Vector<std::thread> workers;
+  workers.reserve(threadCount - 1);
+  for (uint32 t = 1; t < threadCount; ++t)
+  {
+    workers.emplace_back(worker, t);
+  }
+  worker(0);
+
+  for (std::thread &thread : workers)
+  {
+    thread.join();
+  }
+}
+}
+
+/*
+ */
+void
+ConstImageView::convertTo16Bit(ImageView dst, DitherMode mode, bool isRGB565) const
+{
+  if (dst.getBPP() != BPP::BPP_16)
+  {
+    std::cerr << "ConstImageView::convertTo16Bit() " << "Error: Destination must be BPP_16" << std::endl;
+    return;
+  }
+
+  const uint32 width = std::min(m_width, dst.getWidth());
+  const uint32 height = std::min(m_height, dst.getHeight());
+  if (isEmpty() || dst.isEmpty())
+  {
+    return;
+  }
+
+  if (m_bpp == BPP::BPP_16)
+  {
+    for (uint32 y = 0; y < height; ++y)
+    {
+      DitherHelpers::convertRow16(getRow(y), reinterpret_cast<uint16 *>(dst.getRow(y)), width, isRGB565);
+    }
+    return;
+  }
+
+  switch (mode)
+  {
+  case DitherMode::NONE:
+    for (uint32 y = 0; y < height; ++y)
+    {
+      DitherHelpers::convertRowNearest(getRow(y), m_bytesPerPixel, reinterpret_cast<uint16 *>(dst.getRow(y)), width, isRGB565);
+    }
+    break;
+
+  case DitherMode::ORDERED:
+    for (uint32 y = 0; y < height; ++y)
+    {
+      DitherHelpers::ditherOrderedRow(getRow(y), m_bytesPerPixel, reinterpret_cast<uint16 *>(dst.getRow(y)), width, y, isRGB565);
+    }
+    break;
+
+  case DitherMode::FLOYD_STEINBERG:
+    DitherHelpers::ditherFloydSteinberg(*this, dst, width, height, isRGB565);
+    break;
+
+  default:
+    std::cerr << "ConstImageView::convertTo16Bit() Error: Unsupported DitherMode" << std::endl;
+    break;
+  }
+}
+
+/*
+ */
+void
+BitmapImage::convertTo16Bit(BitmapImage &dst, DitherMode mode) const
+{
+  if (&dst == this)
+  {
+    std::cerr << "BitmapImage::convertTo16Bit() " << "Error: Destination must be a different image" << std::endl;
+    return;
+  }
+
+  dst.create(m_width, m_height, BPP::BPP_16);
+  getView().convertTo16Bit(dst.getView(), mode, true);
+}
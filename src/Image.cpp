@@ -3,9 +3,17 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cstddef>
 #include <algorithm>
+#include <limits>
+#include <functional>
+#include <thread>
 #include <math.h>
 
+#if BITMAP_TOOL_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace ImageHelpers
 {
 /*
@@ -47,7 +55,8 @@ readPixel(const uint8 *buffer, const BPP m_bpp)
   switch (m_bpp)
   {
   case BPP::BPP_16:
-    return Color::from16Bit(*reinterpret_cast<const uint16 *>(buffer), true);
+    // Assembled from bytes like writePixel, the buffer is not always 2-byte aligned (uniform tile colors)
+    return Color::from16Bit(static_cast<uint16>(buffer[0] | (buffer[1] << 8)), true);
     break;
   case BPP::BPP_24:
   {
@@ -74,417 +83,1382 @@ readPixel(const uint8 *buffer, const BPP m_bpp)
     break;
   }
 }
+
+/*
+ */
+uint32
+getLineMemoryWidth(uint32 pitch)
+{
+  // BMP rows are padded to a multiple of 4 bytes
+  return (pitch + 3) & ~3u;
 }
 
 /*
+ * BMPFormat struct
+ * Pixel layout of a BMP file as parsed from its headers
  */
-BitmapImage::~BitmapImage()
+struct BMPFormat
 {
-  delete[] m_pixels;
-  m_pixels = nullptr;
+  int32 dataOffset;
+  uint32 width;
+  uint32 height;
+  bool topDown;
+  BPP bpp;
+  uint32 masks[4]; //red, green, blue, alpha
+};
+
+/*
+ */
+uint32
+readUInt32(const uint8 *buffer)
+{
+  uint32 value;
+  std::memcpy(&value, buffer, sizeof(uint32));
+  return value;
 }
 
 /*
  */
-void
-BitmapImage::create(uint32 width, uint32 height, BPP bpp)
+bool
+readHeaders(std::istream &file, BMPFormat &format)
 {
-  if (width <= 0 || height <= 0)
+  // Read the file header and the largest information header (plus trailing masks) in a single read,
+  // small files may end before that so the actual amount read is what gets parsed
+  constexpr uint32 kMaxHeaderBlock = sizeof(BMPHeader) + sizeof(BMPV5Header) + 4 * sizeof(uint32);
+  uint8 block[kMaxHeaderBlock];
+  file.read(reinterpret_cast<char *>(block), kMaxHeaderBlock);
+  const uint32 blockSize = static_cast<uint32>(file.gcount());
+  file.clear();
+
+  BMPHeader header;
+  if (blockSize < sizeof(BMPHeader) + sizeof(BMPInfoHeader))
   {
-    std::cerr << "BitmapImage::create() " << "Error: Invalid dimensions (" << width << ", " << height << ")" << std::endl;
-    return;
+    std::cerr << "BitmapImage::decode() " << "Error: Invalid BMP file format." << std::endl;
+    return false;
   }
+  std::memcpy(&header, block, sizeof(BMPHeader));
 
-  if (m_pixels)
+  if (header.signature[0] != 'B' || header.signature[1] != 'M')
   {
-    delete[] m_pixels;
-    m_pixels = nullptr;
+    std::cerr << "BitmapImage::decode() " << "Error: Invalid BMP file format." << std::endl;
+    return false;
   }
 
-  m_width = width;
-  m_height = height;
-  m_bpp = bpp;
+  const uint8 *infoBlock = block + sizeof(BMPHeader);
+  BMPInfoHeader infoHeader;
+  std::memcpy(&infoHeader, infoBlock, sizeof(BMPInfoHeader));
 
-  m_bytesPerPixel = static_cast<int32>(m_bpp) / 8;
-  m_pitch = m_width * m_bytesPerPixel;
+  const uint32 headerSize = static_cast<uint32>(infoHeader.core.headerSize);
+  if (headerSize < sizeof(BMPInfoHeader) || headerSize > sizeof(BMPV5Header))
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Unsupported BMP header size " << headerSize << std::endl;
+    return false;
+  }
 
-  m_pixels = new uint8[m_pitch * m_height];
-}
+  format.dataOffset = header.dataOffset;
+  format.width = static_cast<uint32>(infoHeader.core.width);
+  format.topDown = infoHeader.core.height < 0;
+  format.height = static_cast<uint32>(format.topDown ? -static_cast<int64_t>(infoHeader.core.height)
+                                                     : infoHeader.core.height);
+  format.bpp = static_cast<BPP>(infoHeader.core.bpp);
 
-/*
- */
-void 
-BitmapImage::clear(const Color &color)
-{
-  std::vector<uint8> buffer(m_bytesPerPixel);
-  ImageHelpers::writePixel(buffer.data(), color, m_bpp);
+  if (infoHeader.core.width <= 0 || format.height == 0)
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Invalid dimensions (" << infoHeader.core.width
+              << ", " << infoHeader.core.height << ")" << std::endl;
+    return false;
+  }
+
+  if (format.bpp != BPP::BPP_16 && format.bpp != BPP::BPP_24 && format.bpp != BPP::BPP_32)
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Unsupported BPP " << infoHeader.core.bpp << std::endl;
+    return false;
+  }
 
-  for (int32 y = 0; y < m_height; ++y)
+  const BMPCompression compression = static_cast<BMPCompression>(infoHeader.compression);
+  if (compression == BMPCompression::RGB)
+  {
+    // Default layouts, 16bpp without masks is RGB555 per the BMP spec
+    const uint32 rgb555[4] = {0x7C00, 0x03E0, 0x001F, 0};
+    const uint32 bgra[4] = {0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000};
+    std::memcpy(format.masks, format.bpp == BPP::BPP_16 ? rgb555 : bgra, sizeof(format.masks));
+  }
+  else if ((compression == BMPCompression::BITFIELDS || compression == BMPCompression::ALPHABITFIELDS) &&
+           format.bpp != BPP::BPP_24)
   {
-    uint8 *row = m_pixels + y * m_pitch;
-    for (int32 x = 0; x < m_width; ++x)
+    // V2 and later headers carry the masks, plain BITMAPINFOHEADER files store them right after the header
+    const uint32 maskCount = compression == BMPCompression::ALPHABITFIELDS ? 4 : 3;
+    const uint32 masksOffset = offsetof(BMPV4Header, redMask);
+    const uint32 masksEnd = sizeof(BMPHeader) + masksOffset + maskCount * sizeof(uint32);
+    if (blockSize < masksEnd)
+    {
+      std::cerr << "BitmapImage::decode() " << "Error: Truncated BMP header." << std::endl;
+      return false;
+    }
+
+    for (uint32 i = 0; i < 4; ++i)
     {
-      std::memcpy(row + x * m_bytesPerPixel, buffer.data(), m_bytesPerPixel);
+      const bool inHeader = masksOffset + (i + 1) * sizeof(uint32) <= headerSize;
+      format.masks[i] = (i < maskCount || inHeader) ? readUInt32(infoBlock + masksOffset + i * sizeof(uint32)) : 0;
     }
   }
+  else
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Unsupported BMP compression " << infoHeader.compression << std::endl;
+    return false;
+  }
+
+  return true;
 }
 
 /*
+ * Check if the pixels of a BMP file can be used as they are, 16bpp images are stored as RGB565 in memory
  */
-Color 
-BitmapImage::getPixel(uint32 x, uint32 y) const
+bool
+isNativeLayout(const BMPFormat &format)
 {
-  if (x >= m_width || y >= m_height)
+  switch (format.bpp)
   {
-    std::cerr << "BitmapImage::getPixel() Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
-    return Color();
+  case BPP::BPP_16:
+    return format.masks[0] == 0xF800 && format.masks[1] == 0x07E0 && format.masks[2] == 0x001F;
+  case BPP::BPP_32:
+    return format.masks[0] == 0x00FF0000 && format.masks[1] == 0x0000FF00 &&
+           format.masks[2] == 0x000000FF && format.masks[3] == 0xFF000000;
+  default:
+    return true;
   }
-
-  const uint8 *buffer = m_pixels + y * m_pitch + x * m_bytesPerPixel;
-  return ImageHelpers::readPixel(buffer, m_bpp);
 }
 
 /*
+ * Extract a channel from a packed pixel and expand it to 8 bits
  */
-void 
-BitmapImage::setPixel(uint32 x, uint32 y, const Color &color)
+uint8
+extractChannel(uint32 value, uint32 mask, uint8 defaultValue)
 {
-  if (x >= m_width || y >= m_height)
+  if (mask == 0)
   {
-    std::cerr << "BitmapImage::setPixel() " << "Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
-    return;
+    return defaultValue;
   }
 
-  uint8 *buffer = m_pixels + y * m_pitch + x * m_bytesPerPixel;
-  ImageHelpers::writePixel(buffer, color, m_bpp);
+  uint32 shift = 0;
+  while (((mask >> shift) & 1) == 0)
+  {
+    ++shift;
+  }
+  uint32 bits = 0;
+  while (shift + bits < 32 && ((mask >> (shift + bits)) & 1) != 0)
+  {
+    ++bits;
+  }
+
+  const uint32 channel = (value & mask) >> shift;
+  if (bits >= 8)
+  {
+    return static_cast<uint8>(channel >> (bits - 8));
+  }
+  return static_cast<uint8>((channel * 255 + ((1u << bits) - 1) / 2) / ((1u << bits) - 1));
 }
 
 /*
+ * Convert a row of pixels from the file layout to the in-memory layout
  */
-Color 
-BitmapImage::getColor(float u, float v) const
+void
+convertRow(uint8 *row, uint32 width, const BMPFormat &format)
 {
-  int32 x = static_cast<int32>(u * (m_width - 1));
-  int32 y = static_cast<int32>(v * (m_height - 1));
+  const uint32 bytesPerPixel = static_cast<uint32>(format.bpp) / 8;
+  for (uint32 x = 0; x < width; ++x)
+  {
+    uint8 *pixel = row + x * bytesPerPixel;
+    uint32 value = 0;
+    std::memcpy(&value, pixel, bytesPerPixel);
 
-  return getPixel(x, y);
+    const uint8 r = extractChannel(value, format.masks[0], 0);
+    const uint8 g = extractChannel(value, format.masks[1], 0);
+    const uint8 b = extractChannel(value, format.masks[2], 0);
+    const uint8 a = extractChannel(value, format.masks[3], 255);
+
+    if (format.bpp == BPP::BPP_16)
+    {
+      const uint16 packed = static_cast<uint16>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+      std::memcpy(pixel, &packed, sizeof(uint16));
+    }
+    else
+    {
+      pixel[0] = b;
+      pixel[1] = g;
+      pixel[2] = r;
+      pixel[3] = a;
+    }
+  }
 }
 
+// Fill pattern length, the smallest multiple of 16 bytes that holds a whole number of 2, 3 and 4 byte pixels
+constexpr size_t kFillPatternSize = 48;
+
+// Fills larger than this bypass the cache with non-temporal stores
+constexpr size_t kNonTemporalFillThreshold = 8u << 20;
+
+// Work smaller than this runs on the calling thread, larger work gets a thread per kBytesPerThread
+constexpr size_t kParallelThreshold = 4u << 20;
+constexpr size_t kBytesPerThread = 1u << 20;
+
 /*
+ * Split [0, height) in bands of rows and run them on worker threads when the work is large enough
  */
-void 
-BitmapImage::setColor(float u, float v, const Color &color)
+void
+forEachRowBand(uint32 height, size_t totalBytes, const std::function<void(uint32, uint32)> &function)
 {
-  int32 x = static_cast<int32>(u * (m_width - 1));
-  int32 y = static_cast<int32>(v * (m_height - 1));
+  size_t threadCount = 1;
+  if (totalBytes >= kParallelThreshold)
+  {
+    threadCount = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()),
+                                    totalBytes / kBytesPerThread,
+                                    height});
+  }
 
-  setPixel(x, y, color);
+  if (threadCount <= 1)
+  {
+    function(0, height);
+    return;
+  }
+
+  const uint32 band = static_cast<uint32>((height + threadCount - 1) / threadCount);
+  Vector<std::thread> workers;
+  workers.reserve(threadCount - 1);
+  for (uint32 y = band; y < height; y += band)
+  {
+    workers.emplace_back(function, y, std::min(y + band, height));
+  }
+  function(0, std::min(band, height));
+
+  for (std::thread &worker : workers)
+  {
+    worker.join();
+  }
 }
 
 /*
+ * Fill bytes with a repeating pixel pattern.
+ * The pattern holds two periods so that a copy can start at any phase.
  */
-bool 
-BitmapImage::decode(const std::string &bmpPath)
+void
+fillBytes(uint8 *dst, size_t bytes, const uint8 *pattern, bool nonTemporal)
 {
-  std::fstream file(bmpPath, std::ios::in | std::ios::binary);
-  if (!file.is_open())
+#if BITMAP_TOOL_SSE2
+  // Align the destination, then store three 16 byte registers (one pattern period) per iteration
+  const size_t head = std::min<size_t>((16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15, bytes);
+  std::memcpy(dst, pattern, head);
+
+  size_t i = head;
+  if (bytes - i >= kFillPatternSize)
   {
-    std::cerr << "Error: Unable to open file " << bmpPath << std::endl;
-    return false;
-  }
+    const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + head));
+    const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + head + 16));
+    const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + head + 32));
 
-  BMPHeader header;
-  file.read(reinterpret_cast<char *>(&header), sizeof(BMPHeader));
+    if (nonTemporal)
+    {
+      for (; i + kFillPatternSize <= bytes; i += kFillPatternSize)
+      {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i), v0);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i + 16), v1);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + i + 32), v2);
+      }
+      _mm_sfence();
+    }
+    else
+    {
+      for (; i + kFillPatternSize <= bytes; i += kFillPatternSize)
+      {
+        _mm_store_si128(reinterpret_cast<__m128i *>(dst + i), v0);
+        _mm_store_si128(reinterpret_cast<__m128i *>(dst + i + 16), v1);
+        _mm_store_si128(reinterpret_cast<__m128i *>(dst + i + 32), v2);
+      }
+    }
+  }
 
-  if (header.signature[0] != 'B' || header.signature[1] != 'M')
+  // Whole periods were stored since the head, so the tail continues at the head phase
+  std::memcpy(dst + i, pattern + head, bytes - i);
+#else
+  (void)nonTemporal;
+  size_t i = 0;
+  for (; i + kFillPatternSize <= bytes; i += kFillPatternSize)
   {
-    std::cerr << "BitmapImage::decode() " << "Error: Invalid BMP file format." << std::endl;
-    file.close();
-    return false;
+    std::memcpy(dst + i, pattern, kFillPatternSize);
   }
+  std::memcpy(dst + i, pattern, bytes - i);
+#endif
+}
 
-  BMPInfoHeaderCore infoHeader;
-  file.read(reinterpret_cast<char *>(&infoHeader), sizeof(BMPInfoHeaderCore));
-
-  create(infoHeader.width, infoHeader.height, static_cast<BPP>(infoHeader.bpp));
+/*
+ * Fill a view with a color
+ */
+void
+fill(ImageView &view, const Color &color)
+{
+  uint8 pixel[4];
+  writePixel(pixel, color, view.getBPP());
 
-  int32 padding = m_pitch % 4;
-  int32 lineMemoryWidth = m_pitch;
-  if (padding != 0)
+  uint8 pattern[2 * kFillPatternSize];
+  const uint32 bytesPerPixel = view.getBytesPerPixel();
+  for (size_t i = 0; i < sizeof(pattern); i += bytesPerPixel)
   {
-    lineMemoryWidth += 4 - padding;
+    std::memcpy(pattern + i, pixel, bytesPerPixel);
   }
 
-  for (int32 y = m_height - 1; y >= 0; --y)
+  const size_t rowBytes = static_cast<size_t>(view.getWidth()) * bytesPerPixel;
+  const size_t totalBytes = rowBytes * view.getHeight();
+  const bool nonTemporal = totalBytes >= kNonTemporalFillThreshold;
+  const bool contiguous = view.getStride() == rowBytes;
+
+  forEachRowBand(view.getHeight(), totalBytes, [&](uint32 firstRow, uint32 lastRow)
   {
-    file.seekp(header.dataOffset + y * lineMemoryWidth);
-    file.read(reinterpret_cast<char *>(m_pixels + m_pitch * (m_height - 1 - y)), m_pitch);
-  }
+    if (contiguous)
+    {
+      // Rows back to back are one long run of pixels
+      fillBytes(view.getRow(firstRow), rowBytes * (lastRow - firstRow), pattern, nonTemporal);
+      return;
+    }
 
-  file.close();
-  return true;
+    for (uint32 y = firstRow; y < lastRow; ++y)
+    {
+      fillBytes(view.getRow(y), rowBytes, pattern, nonTemporal);
+    }
+  });
 }
 
 /*
+ * ChannelSpace struct
+ * Converts color channels to the space filters average them in, and back.
+ * Alpha is already linear and is averaged as stored.
  */
-void 
-BitmapImage::encode(const std::string &filename) const
+struct ChannelSpace
 {
-  std::fstream file(filename + ".bmp", std::ios::out | std::ios::binary);
-  if (!file.is_open())
+  explicit ChannelSpace(BlendSpace space)
+    : toLinear(space == BlendSpace::LINEAR ? Color::getLinearTable() : nullptr),
+      toSRGB(space == BlendSpace::LINEAR ? Color::getSRGBTable() : nullptr)
+  {}
+
+  /*
+   * Add a color to the channel sums
+   */
+  inline void
+  accumulate(uint64 *sum, const Color &color) const
   {
-    std::cerr << "BitmapImage::encode() " << "Error: Unable to open file " << filename << std::endl;
-    return;
+    if (toLinear)
+    {
+      sum[0] += toLinear[color.r];
+      sum[1] += toLinear[color.g];
+      sum[2] += toLinear[color.b];
+    }
+    else
+    {
+      sum[0] += color.r;
+      sum[1] += color.g;
+      sum[2] += color.b;
+    }
+    sum[3] += color.a;
   }
 
-  int32 padding = m_pitch % 4;
-  int32 lineMemoryWidth = m_pitch;
-  if (padding != 0)
+  /*
+   * Get the rounded average color of count accumulated colors
+   */
+  inline Color
+  average(const uint64 *sum, uint64 count) const
   {
-    padding = 4 - padding;
-    lineMemoryWidth += padding;
-  }
+    uint32 channels[4];
+    for (uint32 i = 0; i < 4; ++i)
+    {
+      channels[i] = static_cast<uint32>((sum[i] + count / 2) / count);
+    }
 
-  BMPHeader header;
-  header.signature[0] = 'B';
-  header.signature[1] = 'M';
-  header.fileSize = sizeof(BMPHeader) + sizeof(BMPInfoHeader) + lineMemoryWidth * m_height;
-  header.reserved = 0;
-  header.dataOffset = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+    if (toSRGB)
+    {
+      return Color(toSRGB[channels[0]], toSRGB[channels[1]], toSRGB[channels[2]], static_cast<uint8>(channels[3]));
+    }
+    return Color(static_cast<uint8>(channels[0]), static_cast<uint8>(channels[1]),
+                 static_cast<uint8>(channels[2]), static_cast<uint8>(channels[3]));
+  }
 
-  file.write(reinterpret_cast<const char *>(&header), sizeof(BMPHeader));
+  const uint16 *toLinear;
+  const uint8 *toSRGB;
+};
 
-  BMPInfoHeader infoHeader;
-  infoHeader.core.headerSize = sizeof(BMPInfoHeader);
-  infoHeader.core.width = m_width;
-  infoHeader.core.height = m_height;
-  infoHeader.core.planes = 1;
-  infoHeader.core.bpp = static_cast<int>(m_bpp);
+/*
+ * Nearest neighbour resample of src into dst, mapping the corner pixels onto each other
+ */
+void
+resample(const ConstImageView &src, ImageView &dst)
+{
+  const float scaleX = dst.getWidth() > 1 ? 1 / static_cast<float>(dst.getWidth() - 1) : 0.0f;
+  const float scaleY = dst.getHeight() > 1 ? 1 / static_cast<float>(dst.getHeight() - 1) : 0.0f;
 
-  infoHeader.compression = 0;
-  infoHeader.imageSize = 0;
-  infoHeader.xPixelsPerMeter = 3780; // 96 dpi
-  infoHeader.yPixelsPerMeter = 3780;
-  infoHeader.colorsUsed = 0;
-  infoHeader.importantColors = 0;
+  Vector<uint32> srcXTable(dst.getWidth());
+  for (uint32 x = 0; x < dst.getWidth(); ++x)
+  {
+    const float u = x * scaleX;
+    srcXTable[x] = std::min(static_cast<uint32>(u * (src.getWidth() - 1)), src.getWidth() - 1);
+  }
 
-  file.write(reinterpret_cast<const char *>(&infoHeader), sizeof(BMPInfoHeader));
+  const uint32 srcBytesPerPixel = src.getBytesPerPixel();
+  const uint32 dstBytesPerPixel = dst.getBytesPerPixel();
 
-  const char paddBuffer[3] = {0, 0, 0};
-  for (int y = m_height - 1; y >= 0; --y)
+  for (uint32 y = 0; y < dst.getHeight(); ++y)
   {
-    file.write(reinterpret_cast<const char *>(m_pixels + y * m_pitch), m_pitch);
+    const float v = y * scaleY;
+    const uint32 srcY = std::min(static_cast<uint32>(v * (src.getHeight() - 1)), src.getHeight() - 1);
+    const uint8 *srcRow = src.getRow(srcY);
+    uint8 *dstRow = dst.getRow(y);
 
-    if (padding != 0)
+    for (uint32 x = 0; x < dst.getWidth(); ++x)
     {
-      file.write(paddBuffer, padding);
+      const Color color = readPixel(srcRow + srcXTable[x] * srcBytesPerPixel, src.getBPP());
+      writePixel(dstRow + x * dstBytesPerPixel, color, dst.getBPP());
     }
   }
-
-  file.close();
 }
 
 /*
+ * Area resample of src into dst, each destination pixel averages the source pixels it covers
  */
-void 
-BitmapImage::bitBlt(const BitmapImage &src,
-                    const Rect &srcRect,
-                    const Rect &dstRect,
-                    const TextureMode mode,
-                    const Color &colorKey)
+void
+resampleArea(const ConstImageView &src, ImageView &dst, BlendSpace blendSpace)
 {
-  Rect srcRectClamped = srcRect;
-  srcRectClamped.clamp(Rect(0, 0, src.m_width, src.m_height));
+  const ChannelSpace space(blendSpace);
 
-  Rect dstRectClamped = dstRect;
-  dstRectClamped.clamp(Rect(0, 0, m_width, m_height));
+  // Source span of each destination pixel, at least one pixel wide when enlarging
+  auto span = [](uint32 i, uint32 srcSize, uint32 dstSize, uint32 &begin, uint32 &end)
+  {
+    begin = static_cast<uint32>(static_cast<uint64>(i) * srcSize / dstSize);
+    end = std::max(static_cast<uint32>(static_cast<uint64>(i + 1) * srcSize / dstSize), begin + 1);
+  };
 
-  for (int32 y = 0; y < dstRectClamped.height; ++y)
+  Vector<uint32> columnBegin(dst.getWidth());
+  Vector<uint32> columnEnd(dst.getWidth());
+  for (uint32 x = 0; x < dst.getWidth(); ++x)
   {
-    for (int32 x = 0; x < dstRectClamped.width; ++x)
-    {
-      int32 srcX = 0, srcY = 0;
-      if (!calculateSourceCoordinates(x, y, srcRectClamped, dstRectClamped, mode, srcX, srcY))
-      {
-        continue;
-      }
+    span(x, src.getWidth(), dst.getWidth(), columnBegin[x], columnEnd[x]);
+  }
 
-      Color color = src.getPixel(srcX, srcY);
-      if (color == colorKey)
+  const uint32 srcBytesPerPixel = src.getBytesPerPixel();
+  const uint32 dstBytesPerPixel = dst.getBytesPerPixel();
+  Vector<uint64> sums(static_cast<size_t>(dst.getWidth()) * 4);
+
+  for (uint32 y = 0; y < dst.getHeight(); ++y)
+  {
+    uint32 rowBegin, rowEnd;
+    span(y, src.getHeight(), dst.getHeight(), rowBegin, rowEnd);
+    std::fill(sums.begin(), sums.end(), 0);
+
+    for (uint32 srcY = rowBegin; srcY < rowEnd; ++srcY)
+    {
+      const uint8 *srcRow = src.getRow(srcY);
+      for (uint32 x = 0; x < dst.getWidth(); ++x)
       {
-        continue;
+        uint64 *sum = &sums[x * 4];
+        for (uint32 srcX = columnBegin[x]; srcX < columnEnd[x]; ++srcX)
+        {
+          space.accumulate(sum, readPixel(srcRow + srcX * srcBytesPerPixel, src.getBPP()));
+        }
       }
+    }
 
-      setPixel(dstRectClamped.x + x, dstRectClamped.y + y, color);
+    uint8 *dstRow = dst.getRow(y);
+    for (uint32 x = 0; x < dst.getWidth(); ++x)
+    {
+      const uint64 count = static_cast<uint64>(columnEnd[x] - columnBegin[x]) * (rowEnd - rowBegin);
+      writePixel(dstRow + x * dstBytesPerPixel, space.average(&sums[x * 4], count), dst.getBPP());
     }
   }
 }
+}
 
 /*
  */
-bool 
-BitmapImage::calculateSourceCoordinates(int32 x, int32 y,
-                                        const Rect &srcRect, 
-                                        const Rect &dstRect,
-                                        TextureMode mode,
-                                        int32 &srcX, int32 &srcY)
+ConstImageView::ConstImageView(const uint8 *pixels, uint32 width, uint32 height, uint32 stride, BPP bpp)
+  : m_pixels(pixels),
+    m_width(width),
+    m_height(height),
+    m_stride(stride),
+    m_bpp(bpp),
+    m_bytesPerPixel(static_cast<uint8>(static_cast<int32>(bpp) / 8))
+{}
+
+/*
+ */
+ConstImageView
+ConstImageView::getSubView(const Rect &rect) const
 {
-  switch (mode)
+  Rect clamped = rect;
+  clamped.clamp(Rect(0, 0, m_width, m_height));
+  if (clamped.width == 0 || clamped.height == 0)
   {
-  case TextureMode::NONE:
-    srcX = srcRect.x + x;
-    srcY = srcRect.y + y;
-
-    return srcX >= 0 && srcX < static_cast<int32>(srcRect.width) &&
-          srcY >= 0 && srcY < static_cast<int32>(srcRect.height);
-
-  case TextureMode::REPEAT:
-    return calculateRepeatCoordinates(x, y, srcRect, srcX, srcY);
-
-  case TextureMode::CLAMP:
-    return calculateClampCoordinates(x, y, srcRect, srcX, srcY);
-
-  case TextureMode::MIRROR:
-    return calculateMirrorCoordinates(x, y, srcRect, srcX, srcY);
-
-  case TextureMode::STRETCH:
-    return calculateStretchCoordinates(x, y, srcRect, dstRect, srcX, srcY);
-
-  default:
-    std::cerr << "BitmapImage::calculateSourceCoordinates() Error: Unsupported TextureMode" << std::endl;
-    return false;
+    return ConstImageView(nullptr, 0, 0, m_stride, m_bpp);
   }
+
+  return ConstImageView(getRow(clamped.y) + clamped.x * m_bytesPerPixel,
+                        clamped.width,
+                        clamped.height,
+                        m_stride,
+                        m_bpp);
 }
 
 /*
-*/
-bool 
-BitmapImage::calculateRepeatCoordinates(int32 x, int32 y, 
-                                        const Rect &srcRect,
-                                        int32 &srcX, int32 &srcY)
+ */
+ImageView
+ImageView::getSubView(const Rect &rect) const
 {
-  srcX = (srcRect.x + x) % srcRect.width;
-  if (srcX < 0)
+  Rect clamped = rect;
+  clamped.clamp(Rect(0, 0, m_width, m_height));
+  if (clamped.width == 0 || clamped.height == 0)
   {
-    srcX += srcRect.width;
+    return ImageView(nullptr, 0, 0, m_stride, m_bpp);
   }
 
-  srcY = (srcRect.y + y) % srcRect.height;
-  if (srcY < 0)
+  return ImageView(getRow(clamped.y) + clamped.x * m_bytesPerPixel,
+                   clamped.width,
+                   clamped.height,
+                   m_stride,
+                   m_bpp);
+}
+
+/*
+ */
+Color
+ConstImageView::getPixel(uint32 x, uint32 y) const
+{
+  if (x >= m_width || y >= m_height)
   {
-    srcY += srcRect.height;
+    std::cerr << "ConstImageView::getPixel() Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
+    return Color();
   }
 
-  return true;
+  return ImageHelpers::readPixel(getRow(y) + x * m_bytesPerPixel, m_bpp);
 }
 
 /*
-*/
-bool 
-BitmapImage::calculateClampCoordinates(int32 x, int32 y, 
-                                       const Rect &srcRect,
-                                       int32 &srcX, int32 &srcY)
+ */
+void
+ImageView::setPixel(uint32 x, uint32 y, const Color &color)
 {
-  srcX = std::max(0, std::min(static_cast<int32>(srcRect.x + x), static_cast<int32>(srcRect.width - 1)));
-  srcY = std::max(0, std::min(static_cast<int32>(srcRect.y + y), static_cast<int32>(srcRect.height - 1)));
+  if (x >= m_width || y >= m_height)
+  {
+    std::cerr << "ImageView::setPixel() " << "Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
+    return;
+  }
 
-  return true;
+  ImageHelpers::writePixel(getRow(y) + x * m_bytesPerPixel, color, m_bpp);
 }
 
 /*
-*/
-bool 
-BitmapImage::calculateMirrorCoordinates(int32 x, int32 y, 
-                                        const Rect &srcRect,
-                                        int32 &srcX, int32 &srcY)
+ */
+void
+ImageView::clear(const Color &color)
 {
-    srcX = static_cast<int32>(srcRect.x) + x;
-    srcY = static_cast<int32>(srcRect.y) + y;
+  if (isEmpty())
+  {
+    return;
+  }
+
+  ImageHelpers::fill(*this, color);
+}
+
+/*
+ */
+void
+ImageView::clear(const Rect &rect, const Color &color)
+{
+  fillRect(rect, color);
+}
+
+/*
+ */
+void
+ImageView::fillRect(const Rect &rect, const Color &color)
+{
+  getSubView(rect).clear(color);
+}
+
+/*
+ */
+void
+ImageView::bitBlt(const ConstImageView &src,
+                  const Rect &srcRect,
+                  const Rect &dstRect,
+                  const TextureMode mode,
+                  const Color &colorKey)
+{
+  Rect srcRectClamped = srcRect;
+  srcRectClamped.clamp(Rect(0, 0, src.getWidth(), src.getHeight()));
+  Rect dstRectClamped = dstRect;
+  dstRectClamped.clamp(Rect(0, 0, m_width, m_height));
+
+  if (srcRectClamped.width == 0 || srcRectClamped.height == 0 ||
+      dstRectClamped.width == 0 || dstRectClamped.height == 0)
+  {
+    return;
+  }
+
+  Vector<int32> srcX;
+  Vector<int32> srcY;
+  BitmapImage::buildCoordinateTable(srcRectClamped.x, srcRectClamped.width, dstRectClamped.width, mode, srcX);
+  BitmapImage::buildCoordinateTable(srcRectClamped.y, srcRectClamped.height, dstRectClamped.height, mode, srcY);
 
-    if (srcX < 0)
+  getSubView(dstRectClamped).gather(src, srcX.data(), srcY.data(), colorKey);
+}
+
+/*
+ */
+void
+ImageView::gather(const ConstImageView &src, const int32 *srcXTable, const int32 *srcYTable, const Color &colorKey)
+{
+  const uint32 srcBytesPerPixel = src.getBytesPerPixel();
+
+  for (uint32 y = 0; y < m_height; ++y)
+  {
+    const int32 srcY = srcYTable[y];
+    if (srcY < 0)
     {
-        srcX = -srcX;
+      continue;
     }
-    if (srcX >= static_cast<int32>(srcRect.width))
+
+    const uint8 *srcRow = src.getRow(srcY);
+    uint8 *dstRow = getRow(y);
+
+    for (uint32 x = 0; x < m_width; ++x)
     {
-        srcX %= (2 * static_cast<int32>(srcRect.width));
-        if (srcX >= static_cast<int32>(srcRect.width))
-        {
-            srcX = 2 * static_cast<int32>(srcRect.width) - srcX - 1;
-        }
+      const int32 srcX = srcXTable[x];
+      if (srcX < 0)
+      {
+        continue;
+      }
+
+      Color color = ImageHelpers::readPixel(srcRow + srcX * srcBytesPerPixel, src.getBPP());
+      if (color == colorKey)
+      {
+        continue;
+      }
+
+      ImageHelpers::writePixel(dstRow + x * m_bytesPerPixel, color, m_bpp);
     }
+  }
+}
 
-    if (srcY < 0)
+/*
+ */
+void
+ConstImageView::resizeInto(ImageView dst, ResizeFilter filter, BlendSpace space) const
+{
+  if (isEmpty() || dst.isEmpty())
+  {
+    return;
+  }
+
+  if (filter == ResizeFilter::AREA)
+  {
+    ImageHelpers::resampleArea(*this, dst, space);
+  }
+  else
+  {
+    ImageHelpers::resample(*this, dst);
+  }
+}
+
+/*
+ */
+BitmapImage::~BitmapImage()
+{
+  delete[] m_pixels;
+  m_pixels = nullptr;
+}
+
+/*
+ */
+void
+BitmapImage::create(uint32 width, uint32 height, BPP bpp)
+{
+  if (width <= 0 || height <= 0)
+  {
+    std::cerr << "BitmapImage::create() " << "Error: Invalid dimensions (" << width << ", " << height << ")" << std::endl;
+    return;
+  }
+
+  if (m_pixels)
+  {
+    delete[] m_pixels;
+    m_pixels = nullptr;
+  }
+
+  m_width = width;
+  m_height = height;
+  m_bpp = bpp;
+
+  m_bytesPerPixel = static_cast<int32>(m_bpp) / 8;
+  m_pitch = m_width * m_bytesPerPixel;
+
+  m_pixels = new uint8[static_cast<size_t>(m_pitch) * m_height];
+}
+
+/*
+ */
+ImageView
+BitmapImage::getView()
+{
+  return ImageView(m_pixels, m_width, m_height, m_pitch, m_bpp);
+}
+
+/*
+ */
+ConstImageView
+BitmapImage::getView() const
+{
+  return ConstImageView(m_pixels, m_width, m_height, m_pitch, m_bpp);
+}
+
+/*
+ */
+ImageView
+BitmapImage::getView(const Rect &rect)
+{
+  return getView().getSubView(rect);
+}
+
+/*
+ */
+void 
+BitmapImage::clear(const Color &color)
+{
+  getView().clear(color);
+}
+
+/*
+ */
+void
+BitmapImage::clear(const Rect &rect, const Color &color)
+{
+  fillRect(rect, color);
+}
+
+/*
+ */
+void
+BitmapImage::fillRect(const Rect &rect, const Color &color)
+{
+  getView().fillRect(rect, color);
+}
+
+/*
+ */
+Color 
+BitmapImage::getPixel(uint32 x, uint32 y) const
+{
+  if (x >= m_width || y >= m_height)
+  {
+    std::cerr << "BitmapImage::getPixel() Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
+    return Color();
+  }
+
+  const uint8 *buffer = m_pixels + static_cast<size_t>(y) * m_pitch + x * m_bytesPerPixel;
+  return ImageHelpers::readPixel(buffer, m_bpp);
+}
+
+/*
+ */
+void 
+BitmapImage::setPixel(uint32 x, uint32 y, const Color &color)
+{
+  if (x >= m_width || y >= m_height)
+  {
+    std::cerr << "BitmapImage::setPixel() " << "Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
+    return;
+  }
+
+  uint8 *buffer = m_pixels + static_cast<size_t>(y) * m_pitch + x * m_bytesPerPixel;
+  ImageHelpers::writePixel(buffer, color, m_bpp);
+}
+
+/*
+ */
+Color 
+BitmapImage::getColor(float u, float v) const
+{
+  int32 x = static_cast<int32>(u * (m_width - 1));
+  int32 y = static_cast<int32>(v * (m_height - 1));
+
+  return getPixel(x, y);
+}
+
+/*
+ */
+void 
+BitmapImage::setColor(float u, float v, const Color &color)
+{
+  int32 x = static_cast<int32>(u * (m_width - 1));
+  int32 y = static_cast<int32>(v * (m_height - 1));
+
+  setPixel(x, y, color);
+}
+
+/*
+ */
+bool 
+BitmapImage::decode(const std::string &bmpPath)
+{
+  if (isQOIFile(bmpPath))
+  {
+    const uint32 maxSize = std::numeric_limits<uint32>::max();
+    return decodeQOI(bmpPath, Rect(0, 0, maxSize, maxSize), 1, false, BlendSpace::SRGB);
+  }
+
+  std::fstream file(bmpPath, std::ios::in | std::ios::binary);
+  if (!file.is_open())
+  {
+    std::cerr << "Error: Unable to open file " << bmpPath << std::endl;
+    return false;
+  }
+
+  ImageHelpers::BMPFormat format;
+  if (!ImageHelpers::readHeaders(file, format))
+  {
+    file.close();
+    return false;
+  }
+
+  create(format.width, format.height, format.bpp);
+
+  const uint32 lineMemoryWidth = ImageHelpers::getLineMemoryWidth(m_pitch);
+  file.seekg(format.dataOffset);
+
+  if (lineMemoryWidth == m_pitch)
+  {
+    // No row padding, the whole pixel array is read at once
+    file.read(reinterpret_cast<char *>(m_pixels), static_cast<std::streamsize>(m_pitch) * m_height);
+
+    if (!format.topDown)
     {
-        srcY = -srcY;
+      for (uint32 y = 0; y < m_height / 2; ++y)
+      {
+        std::swap_ranges(m_pixels + static_cast<size_t>(y) * m_pitch,
+                         m_pixels + static_cast<size_t>(y + 1) * m_pitch,
+                         m_pixels + static_cast<size_t>(m_height - 1 - y) * m_pitch);
+      }
     }
-    if (srcY >= static_cast<int32>(srcRect.height))
+  }
+  else
+  {
+    // Read padded rows sequentially in batches and drop the padding
+    const uint32 rowsPerBatch = std::max(1u, (1u << 20) / lineMemoryWidth);
+    Vector<uint8> batch(static_cast<size_t>(rowsPerBatch) * lineMemoryWidth);
+
+    for (uint32 fileRow = 0; fileRow < m_height && file; fileRow += rowsPerBatch)
+    {
+      const uint32 rows = std::min(rowsPerBatch, m_height - fileRow);
+      file.read(reinterpret_cast<char *>(batch.data()), static_cast<std::streamsize>(rows) * lineMemoryWidth);
+
+      for (uint32 i = 0; i < rows; ++i)
+      {
+        const uint32 y = format.topDown ? fileRow + i : m_height - 1 - (fileRow + i);
+        std::memcpy(m_pixels + static_cast<size_t>(y) * m_pitch, batch.data() + i * lineMemoryWidth, m_pitch);
+      }
+    }
+  }
+
+  if (!file)
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Truncated pixel data in " << bmpPath << std::endl;
+    file.close();
+    return false;
+  }
+
+  if (!ImageHelpers::isNativeLayout(format))
+  {
+    for (uint32 y = 0; y < m_height; ++y)
     {
-        srcY %= (2 * static_cast<int32>(srcRect.height));
-        if (srcY >= static_cast<int32>(srcRect.height))
+      ImageHelpers::convertRow(m_pixels + static_cast<size_t>(y) * m_pitch, m_width, format);
+    }
+  }
+
+  file.close();
+  return true;
+}
+
+/*
+ */
+bool
+BitmapImage::decode(const std::string &bmpPath, uint32 downscale, bool boxFilter, BlendSpace space)
+{
+  // The region gets clamped to the file dimensions once the header is read
+  const uint32 maxSize = static_cast<uint32>(std::numeric_limits<int32>::max());
+  return decode(bmpPath, Rect(0, 0, maxSize, maxSize), downscale, boxFilter, space);
+}
+
+/*
+ */
+bool
+BitmapImage::decode(const std::string &bmpPath,
+                    const Rect &region,
+                    uint32 downscale,
+                    bool boxFilter,
+                    BlendSpace space)
+{
+  if (downscale == 0)
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Invalid downscale factor 0" << std::endl;
+    return false;
+  }
+
+  if (isQOIFile(bmpPath))
+  {
+    return decodeQOI(bmpPath, region, downscale, boxFilter, space);
+  }
+
+  std::fstream file(bmpPath, std::ios::in | std::ios::binary);
+  if (!file.is_open())
+  {
+    std::cerr << "Error: Unable to open file " << bmpPath << std::endl;
+    return false;
+  }
+
+  ImageHelpers::BMPFormat format;
+  if (!ImageHelpers::readHeaders(file, format))
+  {
+    file.close();
+    return false;
+  }
+
+  const uint32 fileWidth = format.width;
+  const uint32 fileHeight = format.height;
+  const uint32 bytesPerPixel = static_cast<uint32>(format.bpp) / 8;
+  const bool nativeLayout = ImageHelpers::isNativeLayout(format);
+  const uint32 lineMemoryWidth = ImageHelpers::getLineMemoryWidth(fileWidth * bytesPerPixel);
+
+  Rect srcRect = region;
+  srcRect.clamp(Rect(0, 0, fileWidth, fileHeight));
+  if (srcRect.width == 0 || srcRect.height == 0)
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Region is outside of the image" << std::endl;
+    file.close();
+    return false;
+  }
+
+  // Only the columns of the region are read from each row
+  const uint32 spanBytes = srcRect.width * bytesPerPixel;
+  const uint32 spanOffset = srcRect.x * bytesPerPixel;
+  Vector<uint8> span(spanBytes);
+
+  auto readRow = [&](uint32 y) -> const uint8 *
+  {
+    const uint32 fileRow = format.topDown ? y : fileHeight - 1 - y;
+    file.seekg(format.dataOffset + static_cast<std::streamoff>(fileRow) * lineMemoryWidth + spanOffset);
+    file.read(reinterpret_cast<char *>(span.data()), spanBytes);
+    if (!file)
+    {
+      return nullptr;
+    }
+
+    if (!nativeLayout)
+    {
+      ImageHelpers::convertRow(span.data(), srcRect.width, format);
+    }
+    return span.data();
+  };
+
+  const bool complete = decodeRows(srcRect, format.bpp, downscale, boxFilter, space, readRow);
+  file.close();
+
+  if (!complete)
+  {
+    std::cerr << "BitmapImage::decode() " << "Error: Truncated pixel data in " << bmpPath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ */
+bool
+BitmapImage::decodeRows(const Rect &srcRect,
+                        BPP bpp,
+                        uint32 downscale,
+                        bool boxFilter,
+                        BlendSpace space,
+                        const std::function<const uint8 *(uint32 y)> &readRow)
+{
+  create(static_cast<uint32>((static_cast<uint64>(srcRect.width) + downscale - 1) / downscale),
+         static_cast<uint32>((static_cast<uint64>(srcRect.height) + downscale - 1) / downscale),
+         bpp);
+
+  const uint32 bytesPerPixel = m_bytesPerPixel;
+
+  if (downscale == 1)
+  {
+    for (uint32 y = 0; y < m_height; ++y)
+    {
+      const uint8 *span = readRow(srcRect.y + y);
+      if (!span)
+      {
+        return false;
+      }
+      std::memcpy(m_pixels + static_cast<size_t>(y) * m_pitch, span, static_cast<size_t>(m_width) * bytesPerPixel);
+    }
+  }
+  else if (!boxFilter)
+  {
+    // Sample the top-left pixel of each block, touching one row in every downscale rows
+    for (uint32 y = 0; y < m_height; ++y)
+    {
+      const uint8 *span = readRow(srcRect.y + y * downscale);
+      if (!span)
+      {
+        return false;
+      }
+
+      uint8 *dstRow = m_pixels + static_cast<size_t>(y) * m_pitch;
+      for (uint32 x = 0; x < m_width; ++x)
+      {
+        std::memcpy(dstRow + x * bytesPerPixel,
+                    span + static_cast<size_t>(x) * downscale * bytesPerPixel,
+                    bytesPerPixel);
+      }
+    }
+  }
+  else
+  {
+    const ImageHelpers::ChannelSpace channelSpace(space);
+    Vector<uint64> sums(m_width * 4);
+    Vector<uint32> counts(m_width);
+
+    for (uint32 y = 0; y < m_height; ++y)
+    {
+      std::fill(sums.begin(), sums.end(), 0);
+      std::fill(counts.begin(), counts.end(), 0);
+
+      const uint32 firstRow = srcRect.y + y * downscale;
+      const uint32 lastRow = static_cast<uint32>(std::min<uint64>(static_cast<uint64>(firstRow) + downscale,
+                                                                  srcRect.y + srcRect.height));
+      for (uint32 row = firstRow; row < lastRow; ++row)
+      {
+        const uint8 *span = readRow(row);
+        if (!span)
+        {
+          return false;
+        }
+
+        for (uint32 x = 0; x < srcRect.width; ++x)
         {
-            srcY = 2 * static_cast<int32>(srcRect.height) - srcY - 1;
+          channelSpace.accumulate(&sums[(x / downscale) * 4],
+                                  ImageHelpers::readPixel(span + x * bytesPerPixel, bpp));
+          ++counts[x / downscale];
         }
+      }
+
+      uint8 *dstRow = m_pixels + static_cast<size_t>(y) * m_pitch;
+      for (uint32 x = 0; x < m_width; ++x)
+      {
+        const uint32 count = std::max(counts[x], 1u);
+        ImageHelpers::writePixel(dstRow + x * m_bytesPerPixel, channelSpace.average(&sums[x * 4], count), m_bpp);
+      }
     }
+  }
+
+  return true;
+}
+
+/*
+ */
+bool
+encodeBMP(const std::string &filename,
+          uint32 width,
+          uint32 height,
+          BPP bpp,
+          bool topDown,
+          const std::function<const uint8 *(uint32 y)> &getRow,
+          const uint8 *contiguousPixels)
+{
+  std::fstream file(filename + ".bmp", std::ios::out | std::ios::binary);
+  if (!file.is_open())
+  {
+    std::cerr << "encodeBMP() " << "Error: Unable to open file " << filename << std::endl;
+    return false;
+  }
+
+  const uint32 bytesPerPixel = static_cast<uint32>(bpp) / 8;
+  const uint32 rowBytes = width * bytesPerPixel;
+  const uint32 lineMemoryWidth = ImageHelpers::getLineMemoryWidth(rowBytes);
+
+  // 16bpp images are RGB565 in memory, which needs explicit masks in the file
+  const bool writeMasks = bpp == BPP::BPP_16;
+  const uint32 masks[3] = {0xF800, 0x07E0, 0x001F};
+  const uint32 headersSize = sizeof(BMPHeader) + sizeof(BMPInfoHeader) + (writeMasks ? sizeof(masks) : 0);
+
+  BMPHeader header;
+  header.signature[0] = 'B';
+  header.signature[1] = 'M';
+  header.fileSize = headersSize + lineMemoryWidth * height;
+  header.reserved = 0;
+  header.dataOffset = headersSize;
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(BMPHeader));
+
+  BMPInfoHeader infoHeader;
+  infoHeader.core.headerSize = sizeof(BMPInfoHeader);
+  infoHeader.core.width = width;
+  infoHeader.core.height = topDown ? -static_cast<int32>(height) : static_cast<int32>(height);
+  infoHeader.core.planes = 1;
+  infoHeader.core.bpp = static_cast<int>(bpp);
 
-    if (srcX < 0 || srcX >= static_cast<int32>(srcRect.width) ||
-        srcY < 0 || srcY >= static_cast<int32>(srcRect.height))
+  infoHeader.compression = static_cast<int32>(writeMasks ? BMPCompression::BITFIELDS : BMPCompression::RGB);
+  infoHeader.imageSize = 0;
+  infoHeader.xPixelsPerMeter = 3780; // 96 dpi
+  infoHeader.yPixelsPerMeter = 3780;
+  infoHeader.colorsUsed = 0;
+  infoHeader.importantColors = 0;
+
+  file.write(reinterpret_cast<const char *>(&infoHeader), sizeof(BMPInfoHeader));
+  if (writeMasks)
+  {
+    file.write(reinterpret_cast<const char *>(masks), sizeof(masks));
+  }
+
+  if (topDown && lineMemoryWidth == rowBytes && contiguousPixels)
+  {
+    file.write(reinterpret_cast<const char *>(contiguousPixels), static_cast<std::streamsize>(rowBytes) * height);
+  }
+  else
+  {
+    // Stage padded rows in batches so the file gets a few large writes
+    const uint32 rowsPerBatch = std::max(1u, (1u << 20) / lineMemoryWidth);
+    Vector<uint8> batch(static_cast<size_t>(rowsPerBatch) * lineMemoryWidth, 0);
+
+    for (uint32 fileRow = 0; fileRow < height; fileRow += rowsPerBatch)
     {
-        std::cerr << "calculateMirrorCoordinates() Error: Coordenadas fuera de rango después del cálculo." << std::endl;
-        return false;
+      const uint32 rows = std::min(rowsPerBatch, height - fileRow);
+      for (uint32 i = 0; i < rows; ++i)
+      {
+        const uint32 y = topDown ? fileRow + i : height - 1 - (fileRow + i);
+        std::memcpy(batch.data() + i * lineMemoryWidth, getRow(y), rowBytes);
+      }
+      file.write(reinterpret_cast<const char *>(batch.data()), static_cast<std::streamsize>(rows) * lineMemoryWidth);
     }
+  }
 
-    return true;
+  const bool success = static_cast<bool>(file);
+  file.close();
+  return success;
 }
 
 /*
-*/
-bool 
-BitmapImage::calculateStretchCoordinates(int32 x, int32 y, 
-                                         const Rect &srcRect, 
-                                         const Rect &dstRect,
-                                         int32 &srcX, int32 &srcY)
+ */
+void 
+ConstImageView::encode(const std::string &filename, bool topDown) const
 {
-  const float scaleX = static_cast<float>(srcRect.width) / dstRect.width;
-  const float scaleY = static_cast<float>(srcRect.height) / dstRect.height;
+  if (isEmpty())
+  {
+    std::cerr << "ConstImageView::encode() " << "Error: Empty image" << std::endl;
+    return;
+  }
 
-  srcX = static_cast<int32>(x * scaleX) + srcRect.x;
-  srcY = static_cast<int32>(y * scaleY) + srcRect.y;
+  auto getRowFunction = [this](uint32 y) { return getRow(y); };
+  if (isQOIFile(filename))
+  {
+    encodeQOI(filename, m_width, m_height, m_bpp, getRowFunction);
+    return;
+  }
 
-  return (srcX >= 0 && srcX < srcRect.width && srcY >= 0 && srcY < srcRect.height);
+  const bool contiguous = m_stride == m_width * m_bytesPerPixel;
+  encodeBMP(filename, m_width, m_height, m_bpp, topDown, getRowFunction, contiguous ? m_pixels : nullptr);
 }
 
 /*
  */
-void
-BitmapImage::resize(uint32 width, uint32 height)
+void 
+BitmapImage::encode(const std::string &filename, bool topDown) const
 {
-  if ((width == m_width && height == m_height) || width <= 0 || height <= 0)
+  getView().encode(filename, topDown);
+}
+
+/*
+ */
+void 
+BitmapImage::bitBlt(const BitmapImage &src,
+                    const Rect &srcRect,
+                    const Rect &dstRect,
+                    const TextureMode mode,
+                    const Color &colorKey)
+{
+  bitBlt(src.getView(), srcRect, dstRect, mode, colorKey);
+}
+
+/*
+ */
+void 
+BitmapImage::bitBlt(const ConstImageView &src,
+                    const Rect &srcRect,
+                    const Rect &dstRect,
+                    const TextureMode mode,
+                    const Color &colorKey)
+{
+  Rect srcRectClamped = srcRect;
+  srcRectClamped.clamp(Rect(0, 0, src.getWidth(), src.getHeight()));
+  Rect dstRectClamped = dstRect;
+  dstRectClamped.clamp(Rect(0, 0, m_width, m_height));
+
+  if (srcRectClamped.width == 0 || srcRectClamped.height == 0 ||
+      dstRectClamped.width == 0 || dstRectClamped.height == 0)
   {
     return;
   }
 
-  const float scaleX = 1 / static_cast<float>(width - 1);
-  const float scaleY = 1 / static_cast<float>(height - 1);
+  const BlitCoordinates &coords = getBlitCoordinates(srcRectClamped, dstRectClamped, mode);
 
-  BitmapImage temp;
-  temp.create(width, height, m_bpp);
+  getView(dstRectClamped).gather(src, coords.srcX.data(), coords.srcY.data(), colorKey);
+}
 
-  // #pragma omp parallel for
-  for (int32 y = 0; y < height; ++y)
+/*
+ */
+const BitmapImage::BlitCoordinates &
+BitmapImage::getBlitCoordinates(const Rect &srcRect, const Rect &dstRect, TextureMode mode)
+{
+  auto it = std::find_if(m_blitCache.begin(), m_blitCache.end(),
+                         [&](const BlitCoordinates &entry)
+                         {
+                           return entry.mode == mode &&
+                                  entry.srcRect == srcRect &&
+                                  entry.dstRect == dstRect;
+                         });
+
+  if (it == m_blitCache.end())
   {
-    float v = y * scaleY;
-    for (int32 x = 0; x < width; ++x)
+    if (m_blitCache.size() < kBlitCacheSize)
     {
-      float u = x * scaleX;
-      temp.setPixel(x, y, getColor(u, v));
+      m_blitCache.emplace_back();
     }
+    it = m_blitCache.end() - 1;
+
+    it->srcRect = srcRect;
+    it->dstRect = dstRect;
+    it->mode = mode;
+    buildCoordinateTable(srcRect.x, srcRect.width, dstRect.width, mode, it->srcX);
+    buildCoordinateTable(srcRect.y, srcRect.height, dstRect.height, mode, it->srcY);
   }
 
+  // Keep the most recently used entry at the front so the least recently used one gets evicted
+  std::rotate(m_blitCache.begin(), it, it + 1);
+  return m_blitCache.front();
+}
+
+/*
+ */
+void 
+BitmapImage::buildCoordinateTable(uint32 srcOrigin,
+                                  uint32 srcSize,
+                                  uint32 dstSize,
+                                  TextureMode mode,
+                                  Vector<int32> &table)
+{
+  table.resize(dstSize);
+
+  switch (mode)
+  {
+  case TextureMode::NONE:
+    for (uint32 d = 0; d < dstSize; ++d)
+    {
+      const uint32 s = srcOrigin + d;
+      table[d] = s < srcSize ? static_cast<int32>(s) : -1;
+    }
+    break;
+
+  case TextureMode::REPEAT:
+  {
+    uint32 s = srcOrigin % srcSize;
+    for (uint32 d = 0; d < dstSize; ++d)
+    {
+      table[d] = static_cast<int32>(s);
+      if (++s == srcSize)
+      {
+        s = 0;
+      }
+    }
+    break;
+  }
+
+  case TextureMode::CLAMP:
+    for (uint32 d = 0; d < dstSize; ++d)
+    {
+      table[d] = static_cast<int32>(std::min(srcOrigin + d, srcSize - 1));
+    }
+    break;
+
+  case TextureMode::MIRROR:
+  {
+    // Walk the [0, 2 * size) period, reflecting the second half back onto the source
+    const uint32 period = 2 * srcSize;
+    uint32 s = srcOrigin % period;
+    for (uint32 d = 0; d < dstSize; ++d)
+    {
+      table[d] = static_cast<int32>(s < srcSize ? s : period - s - 1);
+      if (++s == period)
+      {
+        s = 0;
+      }
+    }
+    break;
+  }
+
+  case TextureMode::STRETCH:
+  {
+    // Integer DDA: advance by srcSize / dstSize per step, carrying the remainder
+    const uint32 step = srcSize / dstSize;
+    const uint32 remainder = srcSize % dstSize;
+    uint32 s = srcOrigin;
+    uint32 error = 0;
+    for (uint32 d = 0; d < dstSize; ++d)
+    {
+      table[d] = s < srcSize ? static_cast<int32>(s) : -1;
+      s += step;
+      error += remainder;
+      if (error >= dstSize)
+      {
+        error -= dstSize;
+        ++s;
+      }
+    }
+    break;
+  }
+
+  default:
+    std::cerr << "BitmapImage::buildCoordinateTable() Error: Unsupported TextureMode" << std::endl;
+    std::fill(table.begin(), table.end(), -1);
+    break;
+  }
+}
+
+/*
+ */
+void
+BitmapImage::resizeInto(ImageView dst, ResizeFilter filter, BlendSpace space) const
+{
+  getView().resizeInto(dst, filter, space);
+}
+
+/*
+ */
+void
+BitmapImage::resize(uint32 width, uint32 height, ResizeFilter filter, BlendSpace space)
+{
+  if ((width == m_width && height == m_height) || width <= 0 || height <= 0)
+  {
+    return;
+  }
+
+  BitmapImage temp;
+  temp.create(width, height, m_bpp);
+  resizeInto(temp.getView(), filter, space);
+
   std::swap(m_pixels, temp.m_pixels);
   std::swap(m_width, temp.m_width);
   std::swap(m_height, temp.m_height);
   std::swap(m_bpp, temp.m_bpp);
   std::swap(m_bytesPerPixel, temp.m_bytesPerPixel);
   std::swap(m_pitch, temp.m_pitch);
-}
\ No newline at end of file
+}
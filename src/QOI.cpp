@@ -0,0 +1,384 @@
+#include "Image.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+
+//Ref: https://qoiformat.org/qoi-specification.pdf
+
+namespace QOIHelpers
+{
+constexpr uint8 kOpIndex = 0x00;
+constexpr uint8 kOpDiff = 0x40;
+constexpr uint8 kOpLuma = 0x80;
+constexpr uint8 kOpRun = 0xC0;
+constexpr uint8 kOpRGB = 0xFE;
+constexpr uint8 kOpRGBA = 0xFF;
+constexpr uint8 kOpMask = 0xC0;
+
+constexpr uint32 kHeaderSize = 14;
+constexpr uint8 kEndMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// Encoded bytes are written and read in chunks of this size
+constexpr size_t kChunkSize = 1u << 20;
+
+// Largest encoded pixel (QOI_OP_RGBA)
+constexpr size_t kMaxOpSize = 5;
+
+/*
+ * QOIPixel struct
+ * Pixel in QOI channel order
+ */
+struct QOIPixel
+{
+  uint8 r;
+  uint8 g;
+  uint8 b;
+  uint8 a;
+
+  inline bool
+  operator==(const QOIPixel &other) const
+  {
+    return r == other.r && g == other.g && b == other.b && a == other.a;
+  }
+};
+
+/*
+ */
+inline uint32
+hash(const QOIPixel &px)
+{
+  return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+
+/*
+ */
+inline void
+writeBigEndian(uint8 *buffer, uint32 value)
+{
+  buffer[0] = static_cast<uint8>(value >> 24);
+  buffer[1] = static_cast<uint8>(value >> 16);
+  buffer[2] = static_cast<uint8>(value >> 8);
+  buffer[3] = static_cast<uint8>(value);
+}
+
+/*
+ */
+inline uint32
+readBigEndian(const uint8 *buffer)
+{
+  return (static_cast<uint32>(buffer[0]) << 24) | (static_cast<uint32>(buffer[1]) << 16) |
+         (static_cast<uint32>(buffer[2]) << 8) | buffer[3];
+}
+}
+
+/*
+ */
+bool
+isQOIFile(const std::string &path)
+{
+  constexpr char kExtension[] = ".qoi";
+  constexpr size_t kLength = sizeof(kExtension) - 1;
+  if (path.size() < kLength)
+  {
+    return false;
+  }
+
+  return std::equal(path.end() - kLength, path.end(), kExtension,
+                    [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+}
+
+/*
+ */
+bool
+encodeQOI(const std::string &filename,
+          uint32 width,
+          uint32 height,
+          BPP bpp,
+          const std::function<const uint8 *(uint32 y)> &getRow)
+{
+  using namespace QOIHelpers;
+
+  if (bpp != BPP::BPP_24 && bpp != BPP::BPP_32)
+  {
+    std::cerr << "encodeQOI() " << "Error: Unsupported BPP " << static_cast<int>(bpp) << std::endl;
+    return false;
+  }
+
+  std::fstream file(filename, std::ios::out | std::ios::binary);
+  if (!file.is_open())
+  {
+    std::cerr << "encodeQOI() " << "Error: Unable to open file " << filename << std::endl;
+    return false;
+  }
+
+  const uint32 channels = bpp == BPP::BPP_32 ? 4 : 3;
+  Vector<uint8> out;
+  out.reserve(kChunkSize + kMaxOpSize);
+
+  const uint8 magic[4] = {'q', 'o', 'i', 'f'};
+  out.insert(out.end(), magic, magic + 4);
+  out.resize(kHeaderSize);
+  writeBigEndian(out.data() + 4, width);
+  writeBigEndian(out.data() + 8, height);
+  out[12] = static_cast<uint8>(channels);
+  out[13] = 0; //sRGB with linear alpha
+
+  QOIPixel index[64] = {};
+  QOIPixel prev = {0, 0, 0, 255};
+  uint32 run = 0;
+
+  // QOI rows are always stored top-down
+  for (uint32 y = 0; y < height; ++y)
+  {
+    const uint8 *row = getRow(y);
+    for (uint32 x = 0; x < width; ++x, row += channels)
+    {
+      const QOIPixel px = {row[2], row[1], row[0], channels == 4 ? row[3] : static_cast<uint8>(255)};
+
+      if (px == prev)
+      {
+        if (++run == 62)
+        {
+          out.push_back(static_cast<uint8>(kOpRun | (run - 1)));
+          run = 0;
+        }
+        continue;
+      }
+
+      if (run > 0)
+      {
+        out.push_back(static_cast<uint8>(kOpRun | (run - 1)));
+        run = 0;
+      }
+
+      const uint32 slot = hash(px);
+      if (index[slot] == px)
+      {
+        out.push_back(static_cast<uint8>(kOpIndex | slot));
+      }
+      else
+      {
+        index[slot] = px;
+
+        if (px.a == prev.a)
+        {
+          const int32 dr = static_cast<int8>(px.r - prev.r);
+          const int32 dg = static_cast<int8>(px.g - prev.g);
+          const int32 db = static_cast<int8>(px.b - prev.b);
+          const int32 drdg = dr - dg;
+          const int32 dbdg = db - dg;
+
+          if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+          {
+            out.push_back(static_cast<uint8>(kOpDiff | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+          }
+          else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 && dbdg >= -8 && dbdg <= 7)
+          {
+            out.push_back(static_cast<uint8>(kOpLuma | (dg + 32)));
+            out.push_back(static_cast<uint8>(((drdg + 8) << 4) | (dbdg + 8)));
+          }
+          else
+          {
+            const uint8 op[4] = {kOpRGB, px.r, px.g, px.b};
+            out.insert(out.end(), op, op + 4);
+          }
+        }
+        else
+        {
+          const uint8 op[5] = {kOpRGBA, px.r, px.g, px.b, px.a};
+          out.insert(out.end(), op, op + 5);
+        }
+      }
+
+      prev = px;
+
+      if (out.size() >= kChunkSize)
+      {
+        file.write(reinterpret_cast<const char *>(out.data()), out.size());
+        out.clear();
+      }
+    }
+  }
+
+  if (run > 0)
+  {
+    out.push_back(static_cast<uint8>(kOpRun | (run - 1)));
+  }
+  out.insert(out.end(), kEndMarker, kEndMarker + sizeof(kEndMarker));
+  file.write(reinterpret_cast<const char *>(out.data()), out.size());
+
+  const bool success = static_cast<bool>(file);
+  file.close();
+  return success;
+}
+
+/*
+ */
+bool
+BitmapImage::decodeQOI(const std::string &qoiPath,
+                       const Rect &region,
+                       uint32 downscale,
+                       bool boxFilter,
+                       BlendSpace space)
+{
+  using namespace QOIHelpers;
+
+  std::fstream file(qoiPath, std::ios::in | std::ios::binary);
+  if (!file.is_open())
+  {
+    std::cerr << "Error: Unable to open file " << qoiPath << std::endl;
+    return false;
+  }
+
+  uint8 header[kHeaderSize];
+  file.read(reinterpret_cast<char *>(header), kHeaderSize);
+  if (!file || std::memcmp(header, "qoif", 4) != 0)
+  {
+    std::cerr << "BitmapImage::decodeQOI() " << "Error: Invalid QOI file format." << std::endl;
+    file.close();
+    return false;
+  }
+
+  const uint32 width = readBigEndian(header + 4);
+  const uint32 height = readBigEndian(header + 8);
+  const uint32 channels = header[12];
+  if (width == 0 || height == 0 || (channels != 3 && channels != 4))
+  {
+    std::cerr << "BitmapImage::decodeQOI() " << "Error: Invalid QOI header (" << width << ", " << height
+              << ", " << channels << " channels)" << std::endl;
+    file.close();
+    return false;
+  }
+
+  Rect srcRect = region;
+  srcRect.clamp(Rect(0, 0, width, height));
+  if (srcRect.width == 0 || srcRect.height == 0)
+  {
+    std::cerr << "BitmapImage::decodeQOI() " << "Error: Region is outside of the image" << std::endl;
+    file.close();
+    return false;
+  }
+
+  // Encoded bytes are read in chunks, refilling before an op could cross the end of the chunk
+  Vector<uint8> chunk(kChunkSize + kMaxOpSize);
+  size_t position = 0;
+  size_t available = 0;
+  bool endOfFile = false;
+  auto refill = [&]()
+  {
+    const size_t remaining = available - position;
+    std::memmove(chunk.data(), chunk.data() + position, remaining);
+    file.read(reinterpret_cast<char *>(chunk.data() + remaining), kChunkSize);
+    available = remaining + static_cast<size_t>(file.gcount());
+    position = 0;
+    endOfFile = !file;
+  };
+
+  QOIPixel index[64] = {};
+  QOIPixel px = {0, 0, 0, 255};
+  uint32 run = 0;
+
+  // Decode the next row of the file into row, in memory layout
+  auto decodeRow = [&](uint8 *row) -> bool
+  {
+    for (uint32 x = 0; x < width; ++x, row += channels)
+    {
+      if (run > 0)
+      {
+        --run;
+      }
+      else
+      {
+        if (available - position < kMaxOpSize && !endOfFile)
+        {
+          refill();
+        }
+        if (position >= available)
+        {
+          return false;
+        }
+
+        const uint8 op = chunk[position++];
+        if (op == kOpRGB)
+        {
+          px.r = chunk[position];
+          px.g = chunk[position + 1];
+          px.b = chunk[position + 2];
+          position += 3;
+        }
+        else if (op == kOpRGBA)
+        {
+          px.r = chunk[position];
+          px.g = chunk[position + 1];
+          px.b = chunk[position + 2];
+          px.a = chunk[position + 3];
+          position += 4;
+        }
+        else if ((op & kOpMask) == kOpIndex)
+        {
+          px = index[op];
+        }
+        else if ((op & kOpMask) == kOpDiff)
+        {
+          px.r += ((op >> 4) & 0x03) - 2;
+          px.g += ((op >> 2) & 0x03) - 2;
+          px.b += (op & 0x03) - 2;
+        }
+        else if ((op & kOpMask) == kOpLuma)
+        {
+          const uint8 next = chunk[position++];
+          const int32 dg = (op & 0x3F) - 32;
+          px.r += dg - 8 + ((next >> 4) & 0x0F);
+          px.g += dg;
+          px.b += dg - 8 + (next & 0x0F);
+        }
+        else
+        {
+          run = op & 0x3F;
+        }
+
+        index[hash(px)] = px;
+      }
+
+      row[0] = px.b;
+      row[1] = px.g;
+      row[2] = px.r;
+      if (channels == 4)
+      {
+        row[3] = px.a;
+      }
+    }
+
+    // The last op of a truncated file can read past the end of the data
+    return position <= available;
+  };
+
+  // QOI has no random access, rows are decoded in order up to the requested one
+  Vector<uint8> rowBuffer(static_cast<size_t>(width) * channels);
+  uint32 nextRow = 0;
+  auto readRow = [&](uint32 y) -> const uint8 *
+  {
+    for (; nextRow <= y; ++nextRow)
+    {
+      if (!decodeRow(rowBuffer.data()))
+      {
+        return nullptr;
+      }
+    }
+    return rowBuffer.data() + static_cast<size_t>(srcRect.x) * channels;
+  };
+
+  const bool complete = decodeRows(srcRect, channels == 4 ? BPP::BPP_32 : BPP::BPP_24,
+                                   downscale, boxFilter, space, readRow);
+  file.close();
+
+  if (!complete)
+  {
+    std::cerr << "BitmapImage::decodeQOI() " << "Error: Truncated pixel data in " << qoiPath << std::endl;
+    return false;
+  }
+  return true;
+}
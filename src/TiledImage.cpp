@@ -0,0 +1,581 @@
+#include "TiledImage.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+namespace TileHelpers
+{
+// Control bytes of the tile codec, the low bits hold the pixel count minus one
+constexpr uint8 kLiteral = 0x00;  //0x00-0x7F: up to 128 literal pixels follow
+constexpr uint8 kRun = 0x80;      //0x80-0xBF: up to 64 copies of the pixel that follows
+constexpr uint8 kCopyAbove = 0xC0; //0xC0-0xFF: up to 64 pixels copied from the row above
+constexpr uint32 kMaxLiteral = 128;
+constexpr uint32 kMaxRun = 64;
+
+/*
+ * Compress tightly packed tile pixels
+ */
+void
+compress(const uint8 *pixels, uint32 count, uint32 rowPixels, uint32 bytesPerPixel, Vector<uint8> &out)
+{
+  out.clear();
+
+  auto same = [&](uint32 a, uint32 b)
+  {
+    return std::memcmp(pixels + a * bytesPerPixel, pixels + b * bytesPerPixel, bytesPerPixel) == 0;
+  };
+
+  uint32 literalStart = 0;
+  uint32 literalCount = 0;
+  auto flushLiteral = [&]()
+  {
+    if (literalCount == 0)
+    {
+      return;
+    }
+    out.push_back(static_cast<uint8>(kLiteral | (literalCount - 1)));
+    out.insert(out.end(),
+               pixels + literalStart * bytesPerPixel,
+               pixels + (literalStart + literalCount) * bytesPerPixel);
+    literalCount = 0;
+  };
+
+  uint32 i = 0;
+  while (i < count)
+  {
+    uint32 run = 1;
+    while (i + run < count && run < kMaxRun && same(i + run, i))
+    {
+      ++run;
+    }
+
+    uint32 copy = 0;
+    if (i >= rowPixels)
+    {
+      while (i + copy < count && copy < kMaxRun && same(i + copy, i + copy - rowPixels))
+      {
+        ++copy;
+      }
+    }
+
+    if (run >= 2 || copy >= 2)
+    {
+      flushLiteral();
+      if (copy >= run)
+      {
+        out.push_back(static_cast<uint8>(kCopyAbove | (copy - 1)));
+        i += copy;
+      }
+      else
+      {
+        out.push_back(static_cast<uint8>(kRun | (run - 1)));
+        out.insert(out.end(), pixels + i * bytesPerPixel, pixels + (i + 1) * bytesPerPixel);
+        i += run;
+      }
+      continue;
+    }
+
+    if (literalCount == kMaxLiteral)
+    {
+      flushLiteral();
+    }
+    if (literalCount == 0)
+    {
+      literalStart = i;
+    }
+    ++literalCount;
+    ++i;
+  }
+
+  flushLiteral();
+}
+
+/*
+ * Decompress tile pixels written by compress
+ */
+void
+decompress(const Vector<uint8> &data, uint8 *pixels, uint32 count, uint32 rowPixels, uint32 bytesPerPixel)
+{
+  const uint32 totalBytes = count * bytesPerPixel;
+  const uint32 rowBytes = rowPixels * bytesPerPixel;
+  uint32 out = 0;
+  size_t in = 0;
+
+  while (in < data.size() && out < totalBytes)
+  {
+    const uint8 control = data[in++];
+    if (control < kRun)
+    {
+      const uint32 bytes = std::min((control - kLiteral + 1u) * bytesPerPixel, totalBytes - out);
+      std::memcpy(pixels + out, data.data() + in, bytes);
+      in += bytes;
+      out += bytes;
+    }
+    else if (control < kCopyAbove)
+    {
+      const uint32 n = control - kRun + 1;
+      for (uint32 p = 0; p < n && out < totalBytes; ++p, out += bytesPerPixel)
+      {
+        std::memcpy(pixels + out, data.data() + in, bytesPerPixel);
+      }
+      in += bytesPerPixel;
+    }
+    else
+    {
+      // Source and destination are a row apart, copy forward so they may overlap
+      const uint32 bytes = std::min((control - kCopyAbove + 1u) * bytesPerPixel, totalBytes - out);
+      for (uint32 b = 0; b < bytes; ++b, ++out)
+      {
+        pixels[out] = pixels[out - rowBytes];
+      }
+    }
+  }
+}
+
+/*
+ * Fill a view with raw pixel bytes
+ */
+void
+fillRaw(ImageView &view, const uint8 *pixel)
+{
+  const uint32 bytesPerPixel = view.getBytesPerPixel();
+  for (uint32 y = 0; y < view.getHeight(); ++y)
+  {
+    uint8 *row = view.getRow(y);
+    for (uint32 x = 0; x < view.getWidth(); ++x)
+    {
+      std::memcpy(row + x * bytesPerPixel, pixel, bytesPerPixel);
+    }
+  }
+}
+}
+
+/*
+ */
+void
+TiledImage::create(uint32 width, uint32 height, BPP bpp, uint32 tileSize)
+{
+  if (width <= 0 || height <= 0 || tileSize <= 0)
+  {
+    std::cerr << "TiledImage::create() " << "Error: Invalid dimensions (" << width << ", " << height
+              << ") or tile size " << tileSize << std::endl;
+    return;
+  }
+
+  m_width = width;
+  m_height = height;
+  m_tileSize = tileSize;
+  m_tilesX = (width + tileSize - 1) / tileSize;
+  m_tilesY = (height + tileSize - 1) / tileSize;
+  m_bpp = bpp;
+  m_bytesPerPixel = static_cast<uint8>(static_cast<int32>(m_bpp) / 8);
+
+  m_hotTiles.clear();
+  m_tiles.assign(static_cast<size_t>(m_tilesX) * m_tilesY, Tile{TileEncoding::UNIFORM, {0, 0, 0, 0}, {}});
+}
+
+/*
+ */
+Rect
+TiledImage::getTileRect(uint32 index) const
+{
+  const uint32 x = (index % m_tilesX) * m_tileSize;
+  const uint32 y = (index / m_tilesX) * m_tileSize;
+  return Rect(x, y, std::min(m_tileSize, m_width - x), std::min(m_tileSize, m_height - y));
+}
+
+/*
+ */
+ImageView
+TiledImage::acquireTile(uint32 index, bool write) const
+{
+  auto it = std::find_if(m_hotTiles.begin(), m_hotTiles.end(),
+                         [index](const HotTile &hot) { return hot.index == index; });
+
+  const Rect tileRect = getTileRect(index);
+  const uint32 stride = tileRect.width * m_bytesPerPixel;
+
+  if (it == m_hotTiles.end())
+  {
+    if (m_hotTiles.size() < kHotTileCount)
+    {
+      m_hotTiles.emplace_back();
+      it = m_hotTiles.end() - 1;
+    }
+    else
+    {
+      // Evict the least recently used tile and reuse its buffer
+      it = m_hotTiles.end() - 1;
+      if (it->dirty)
+      {
+        storeTile(*it);
+      }
+    }
+
+    // The slot must not look like the tile being read while it gets filled
+    it->index = std::numeric_limits<uint32>::max();
+    it->dirty = false;
+    it->pixels.resize(static_cast<size_t>(stride) * tileRect.height);
+    readTile(index,
+             Rect(0, 0, tileRect.width, tileRect.height),
+             ImageView(it->pixels.data(), tileRect.width, tileRect.height, stride, m_bpp));
+    it->index = index;
+  }
+
+  std::rotate(m_hotTiles.begin(), it, it + 1);
+  HotTile &hot = m_hotTiles.front();
+  hot.dirty = hot.dirty || write;
+  return ImageView(hot.pixels.data(), tileRect.width, tileRect.height, stride, m_bpp);
+}
+
+/*
+ */
+void
+TiledImage::readTile(uint32 index, const Rect &part, ImageView dst) const
+{
+  const Rect tileRect = getTileRect(index);
+  const uint32 stride = tileRect.width * m_bytesPerPixel;
+  const uint32 partBytes = part.width * m_bytesPerPixel;
+
+  auto copyRows = [&](const uint8 *pixels)
+  {
+    for (uint32 y = 0; y < part.height; ++y)
+    {
+      std::memcpy(dst.getRow(y), pixels + (part.y + y) * stride + part.x * m_bytesPerPixel, partBytes);
+    }
+  };
+
+  auto hot = std::find_if(m_hotTiles.begin(), m_hotTiles.end(),
+                          [index](const HotTile &entry) { return entry.index == index; });
+  if (hot != m_hotTiles.end())
+  {
+    copyRows(hot->pixels.data());
+    return;
+  }
+
+  const Tile &tile = m_tiles[index];
+  switch (tile.encoding)
+  {
+  case TileEncoding::UNIFORM:
+    TileHelpers::fillRaw(dst, tile.color);
+    break;
+
+  case TileEncoding::RAW:
+    copyRows(tile.data.data());
+    break;
+
+  case TileEncoding::RLE:
+  {
+    Vector<uint8> pixels(static_cast<size_t>(stride) * tileRect.height);
+    TileHelpers::decompress(tile.data, pixels.data(), tileRect.width * tileRect.height, tileRect.width, m_bytesPerPixel);
+    copyRows(pixels.data());
+    break;
+  }
+
+  default:
+    std::cerr << "TiledImage::readTile() Error: Unsupported TileEncoding" << std::endl;
+    break;
+  }
+}
+
+/*
+ */
+void
+TiledImage::storeTile(HotTile &hot) const
+{
+  Tile &tile = m_tiles[hot.index];
+  const Rect tileRect = getTileRect(hot.index);
+  const uint32 count = tileRect.width * tileRect.height;
+  const uint8 *pixels = hot.pixels.data();
+
+  hot.dirty = false;
+
+  bool uniform = true;
+  for (uint32 i = 1; i < count && uniform; ++i)
+  {
+    uniform = std::memcmp(pixels, pixels + i * m_bytesPerPixel, m_bytesPerPixel) == 0;
+  }
+
+  if (uniform)
+  {
+    tile.encoding = TileEncoding::UNIFORM;
+    std::memcpy(tile.color, pixels, m_bytesPerPixel);
+    Vector<uint8>().swap(tile.data);
+    return;
+  }
+
+  Vector<uint8> compressed;
+  TileHelpers::compress(pixels, count, tileRect.width, m_bytesPerPixel, compressed);
+  if (compressed.size() < hot.pixels.size())
+  {
+    tile.encoding = TileEncoding::RLE;
+    tile.data.assign(compressed.begin(), compressed.end());
+  }
+  else
+  {
+    tile.encoding = TileEncoding::RAW;
+    tile.data.assign(hot.pixels.begin(), hot.pixels.end());
+  }
+}
+
+/*
+ */
+void
+TiledImage::setTileUniform(uint32 index, const uint8 *pixel)
+{
+  m_hotTiles.erase(std::remove_if(m_hotTiles.begin(), m_hotTiles.end(),
+                                  [index](const HotTile &hot) { return hot.index == index; }),
+                   m_hotTiles.end());
+
+  Tile &tile = m_tiles[index];
+  tile.encoding = TileEncoding::UNIFORM;
+  std::memcpy(tile.color, pixel, m_bytesPerPixel);
+  Vector<uint8>().swap(tile.data);
+}
+
+/*
+ */
+void
+TiledImage::clear(const Color &color)
+{
+  fillRect(Rect(0, 0, m_width, m_height), color);
+}
+
+/*
+ */
+void
+TiledImage::fillRect(const Rect &rect, const Color &color)
+{
+  Rect fill = rect;
+  fill.clamp(Rect(0, 0, m_width, m_height));
+  if (fill.width == 0 || fill.height == 0)
+  {
+    return;
+  }
+
+  uint8 pixel[4] = {0, 0, 0, 0};
+  ImageView(pixel, 1, 1, sizeof(pixel), m_bpp).setPixel(0, 0, color);
+
+  for (uint32 ty = fill.y / m_tileSize; ty <= (fill.y + fill.height - 1) / m_tileSize; ++ty)
+  {
+    for (uint32 tx = fill.x / m_tileSize; tx <= (fill.x + fill.width - 1) / m_tileSize; ++tx)
+    {
+      const uint32 index = ty * m_tilesX + tx;
+      const Rect tileRect = getTileRect(index);
+      Rect part = fill;
+      part.clamp(tileRect);
+
+      if (part.width == tileRect.width && part.height == tileRect.height)
+      {
+        setTileUniform(index, pixel);
+        continue;
+      }
+
+      acquireTile(index, true).clear(Rect(part.x - tileRect.x, part.y - tileRect.y, part.width, part.height), color);
+    }
+  }
+}
+
+/*
+ */
+Color
+TiledImage::getPixel(uint32 x, uint32 y) const
+{
+  if (x >= m_width || y >= m_height)
+  {
+    std::cerr << "TiledImage::getPixel() Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
+    return Color();
+  }
+
+  const uint32 index = (y / m_tileSize) * m_tilesX + x / m_tileSize;
+  Tile &tile = m_tiles[index];
+  const bool hot = std::any_of(m_hotTiles.begin(), m_hotTiles.end(),
+                               [index](const HotTile &entry) { return entry.index == index; });
+  if (!hot && tile.encoding == TileEncoding::UNIFORM)
+  {
+    return ImageView(tile.color, 1, 1, sizeof(tile.color), m_bpp).getPixel(0, 0);
+  }
+
+  return acquireTile(index, false).getPixel(x % m_tileSize, y % m_tileSize);
+}
+
+/*
+ */
+void
+TiledImage::setPixel(uint32 x, uint32 y, const Color &color)
+{
+  if (x >= m_width || y >= m_height)
+  {
+    std::cerr << "TiledImage::setPixel() " << "Error: Invalid pixel coordinates (" << x << ", " << y << ")" << std::endl;
+    return;
+  }
+
+  const uint32 index = (y / m_tileSize) * m_tilesX + x / m_tileSize;
+  acquireTile(index, true).setPixel(x % m_tileSize, y % m_tileSize, color);
+}
+
+/*
+ */
+void
+TiledImage::bitBlt(const BitmapImage &src,
+                   const Rect &srcRect,
+                   const Rect &dstRect,
+                   const TextureMode mode,
+                   const Color &colorKey)
+{
+  bitBlt(src.getView(), srcRect, dstRect, mode, colorKey);
+}
+
+/*
+ */
+void
+TiledImage::bitBlt(const ConstImageView &src,
+                   const Rect &srcRect,
+                   const Rect &dstRect,
+                   const TextureMode mode,
+                   const Color &colorKey)
+{
+  Rect srcRectClamped = srcRect;
+  srcRectClamped.clamp(Rect(0, 0, src.getWidth(), src.getHeight()));
+
+  Rect dstRectClamped = dstRect;
+  dstRectClamped.clamp(Rect(0, 0, m_width, m_height));
+
+  if (srcRectClamped.width == 0 || srcRectClamped.height == 0 ||
+      dstRectClamped.width == 0 || dstRectClamped.height == 0)
+  {
+    return;
+  }
+
+  // The tables cover the whole destination rectangle, each tile uses its slice of them
+  Vector<int32> srcX;
+  Vector<int32> srcY;
+  BitmapImage::buildCoordinateTable(srcRectClamped.x, srcRectClamped.width, dstRectClamped.width, mode, srcX);
+  BitmapImage::buildCoordinateTable(srcRectClamped.y, srcRectClamped.height, dstRectClamped.height, mode, srcY);
+
+  const uint32 lastTileX = (dstRectClamped.x + dstRectClamped.width - 1) / m_tileSize;
+  const uint32 lastTileY = (dstRectClamped.y + dstRectClamped.height - 1) / m_tileSize;
+  for (uint32 ty = dstRectClamped.y / m_tileSize; ty <= lastTileY; ++ty)
+  {
+    for (uint32 tx = dstRectClamped.x / m_tileSize; tx <= lastTileX; ++tx)
+    {
+      const uint32 index = ty * m_tilesX + tx;
+      const Rect tileRect = getTileRect(index);
+      Rect part = dstRectClamped;
+      part.clamp(tileRect);
+
+      ImageView tile = acquireTile(index, true);
+      tile.getSubView(Rect(part.x - tileRect.x, part.y - tileRect.y, part.width, part.height))
+          .gather(src,
+                  srcX.data() + (part.x - dstRectClamped.x),
+                  srcY.data() + (part.y - dstRectClamped.y),
+                  colorKey);
+    }
+  }
+}
+
+/*
+ */
+void
+TiledImage::copyTo(const Rect &rect, ImageView dst) const
+{
+  Rect region = rect;
+  region.clamp(Rect(0, 0, m_width, m_height));
+  if (region.width == 0 || region.height == 0)
+  {
+    return;
+  }
+
+  if (dst.getBPP() != m_bpp || dst.getWidth() < region.width || dst.getHeight() < region.height)
+  {
+    std::cerr << "TiledImage::copyTo() " << "Error: Destination does not match the region" << std::endl;
+    return;
+  }
+
+  const uint32 lastTileX = (region.x + region.width - 1) / m_tileSize;
+  const uint32 lastTileY = (region.y + region.height - 1) / m_tileSize;
+  for (uint32 ty = region.y / m_tileSize; ty <= lastTileY; ++ty)
+  {
+    for (uint32 tx = region.x / m_tileSize; tx <= lastTileX; ++tx)
+    {
+      const uint32 index = ty * m_tilesX + tx;
+      const Rect tileRect = getTileRect(index);
+      Rect part = region;
+      part.clamp(tileRect);
+
+      readTile(index,
+               Rect(part.x - tileRect.x, part.y - tileRect.y, part.width, part.height),
+               dst.getSubView(Rect(part.x - region.x, part.y - region.y, part.width, part.height)));
+    }
+  }
+}
+
+/*
+ */
+void
+TiledImage::encode(const std::string &filename, bool topDown) const
+{
+  if (m_tiles.empty())
+  {
+    std::cerr << "TiledImage::encode() " << "Error: Empty image" << std::endl;
+    return;
+  }
+
+  // Rows are requested in file order, so each band of tiles is decompressed once
+  const uint32 bandStride = m_width * m_bytesPerPixel;
+  Vector<uint8> band(static_cast<size_t>(bandStride) * m_tileSize);
+  ImageView bandView(band.data(), m_width, m_tileSize, bandStride, m_bpp);
+  uint32 currentBand = m_tilesY;
+
+  auto getRowFunction = [&](uint32 y)
+  {
+    const uint32 tileY = y / m_tileSize;
+    if (tileY != currentBand)
+    {
+      currentBand = tileY;
+      copyTo(Rect(0, tileY * m_tileSize, m_width, m_tileSize), bandView);
+    }
+    return bandView.getRow(y - tileY * m_tileSize);
+  };
+
+  if (isQOIFile(filename))
+  {
+    encodeQOI(filename, m_width, m_height, m_bpp, getRowFunction);
+    return;
+  }
+
+  encodeBMP(filename, m_width, m_height, m_bpp, topDown, getRowFunction);
+}
+
+/*
+ */
+void
+TiledImage::flush() const
+{
+  for (HotTile &hot : m_hotTiles)
+  {
+    if (hot.dirty)
+    {
+      storeTile(hot);
+    }
+  }
+}
+
+/*
+ */
+size_t
+TiledImage::getMemoryUsage() const
+{
+  size_t bytes = m_tiles.capacity() * sizeof(Tile);
+  for (const Tile &tile : m_tiles)
+  {
+    bytes += tile.data.capacity();
+  }
+  for (const HotTile &hot : m_hotTiles)
+  {
+    bytes += sizeof(HotTile) + hot.pixels.capacity();
+  }
+  return bytes;
+}